@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) 2026, agent
+ * All rights reserved.
+ *
+ * Authors: agent <agent@local>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "os.h"
+#include "client.h"
+
+#define SOCKET_BUFFER (4 * 1024 * 1024)
+
+unsigned client_chunk = 1024 * 1024;
+
+pid_t client_start(int (*client)(int fd, void *arg), void *arg, int *fd)
+{
+	int fds[2], size = SOCKET_BUFFER, i;
+	pid_t pid;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+		perror("socketpair");
+		return -1;
+	}
+	for (i = 0; i < 2; i++) {
+		setsockopt(fds[i], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+		setsockopt(fds[i], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	}
+
+	fflush(stdout);
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+	if (!pid) {
+		close(fds[0]);
+		setvbuf(stdout, NULL, _IOLBF, 0);
+		exit(client(fds[1], arg) ? 1 : 0);
+	}
+
+	close(fds[1]);
+	*fd = fds[0];
+	return pid;
+}
+
+int client_wait(pid_t pid)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+		return -1;
+	return 0;
+}
+
+static int send_frame(int fd, const void *data, unsigned len)
+{
+	unsigned hdr = len;
+
+	if (os_write_full(fd, &hdr, sizeof(hdr)) || os_write_full(fd, data, len)) {
+		fprintf(stderr, "client: send failed\n");
+		return -1;
+	}
+	return 0;
+}
+
+static int recv_frame(int fd, char *buf, unsigned size)
+{
+	unsigned len;
+
+	if (os_read_full(fd, &len, sizeof(len)) || len >= size ||
+	    os_read_full(fd, buf, len)) {
+		fprintf(stderr, "client: receive failed\n");
+		return -1;
+	}
+	buf[len] = '\0';
+	return len;
+}
+
+static int response(int fd, const char *cmd, char *resp, unsigned *infos, int verbose)
+{
+	if (infos)
+		*infos = 0;
+
+	for (;;) {
+		if (recv_frame(fd, resp, RESPONSE_LENGTH + 1) < 0)
+			return -1;
+		if (!strncmp(resp, "INFO", 4)) {
+			if (infos)
+				(*infos)++;
+			if (verbose)
+				printf("(bootloader) %s\n", resp + 4);
+			continue;
+		}
+		if (!strncmp(resp, "OKAY", 4) || !strncmp(resp, "DATA", 4))
+			return 0;
+		fprintf(stderr, "%s: %s\n", cmd, resp);
+		return -1;
+	}
+}
+
+int client_command(int fd, const char *cmd, char *resp, unsigned *infos, int verbose)
+{
+	if (send_frame(fd, cmd, strlen(cmd)))
+		return -1;
+	return response(fd, cmd, resp, infos, verbose);
+}
+
+int client_download(int fd, const void *data, unsigned size, unsigned long long *us)
+{
+	char cmd[32], resp[RESPONSE_LENGTH + 1];
+	unsigned long long start;
+	unsigned offset, len;
+
+	snprintf(cmd, sizeof(cmd), "download:%08x", size);
+	start = os_time_us();
+	if (client_command(fd, cmd, resp, NULL, 1))
+		return -1;
+	if (strncmp(resp, "DATA", 4) || strtoul(resp + 4, NULL, 16) != size) {
+		fprintf(stderr, "%s: unexpected %s\n", cmd, resp);
+		return -1;
+	}
+
+	for (offset = 0; offset < size; offset += len) {
+		len = size - offset < client_chunk ? size - offset : client_chunk;
+		if (send_frame(fd, (const char *)data + offset, len))
+			return -1;
+	}
+
+	if (response(fd, cmd, resp, NULL, 1))
+		return -1;
+	if (us)
+		*us = os_time_us() - start;
+	return 0;
+}
+
+int client_download_file(int fd, const char *path)
+{
+	struct stat st;
+	void *data;
+	int file, ret;
+
+	file = open(path, O_RDONLY);
+	if (file < 0 || fstat(file, &st)) {
+		perror(path);
+		if (file >= 0)
+			close(file);
+		return -1;
+	}
+
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+	close(file);
+	if (data == MAP_FAILED) {
+		perror(path);
+		return -1;
+	}
+
+	ret = client_download(fd, data, st.st_size, NULL);
+	munmap(data, st.st_size);
+	return ret;
+}
+
+int client_run(int fd, int argc, char **argv)
+{
+	char resp[RESPONSE_LENGTH + 1];
+	int i;
+
+	for (i = 0; i < argc; i++) {
+		printf("> %s\n", argv[i]);
+		if (argv[i][0] == '@') {
+			if (client_download_file(fd, argv[i] + 1))
+				return -1;
+			continue;
+		}
+		if (client_command(fd, argv[i], resp, NULL, 1))
+			return -1;
+		if (resp[4])
+			printf("%s\n", resp + 4);
+	}
+
+	return 0;
+}
+
+void client_random(void *data, unsigned long size, unsigned long long *state)
+{
+	unsigned long long *pos = data;
+	unsigned long i;
+
+	for (i = 0; i < size / sizeof(*pos); i++) {
+		*state ^= *state << 13;
+		*state ^= *state >> 7;
+		*state ^= *state << 17;
+		pos[i] = *state;
+	}
+}
+
+void client_print_rate(unsigned long long bytes, unsigned long long us)
+{
+	if (!us)
+		us = 1;
+	if (bytes < 1024 * 1024)
+		printf("%llu KiB in", bytes >> 10);
+	else
+		printf("%llu MiB in", bytes >> 20);
+	printf(" %llu.%03llu s: %llu.%02llu MiB/s\n",
+	       us / 1000000, us / 1000 % 1000,
+	       bytes * 1000000 / us >> 20, (bytes * 1000000 / us * 100 >> 20) % 100);
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2026, agent
+ * All rights reserved.
+ *
+ * Authors: agent <agent@local>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _HOST_CLIENT_H_
+#define _HOST_CLIENT_H_
+
+#include <sys/types.h>
+
+/* Scripted fastboot client of the benchmark programs, built against
+ * the C library.  It talks to the USB stand-in with the framing
+ * described in host.h.  The functions returning int return 0 on
+ * success, -1 on error. */
+
+/* Replies are 64 bytes */
+#define RESPONSE_LENGTH 64
+
+/* Size of the frames the data is sent in, in bytes */
+extern unsigned client_chunk;
+
+/* Fork a process running CLIENT with the other end of a socket pair.
+ * The device end is returned in *FD. */
+pid_t client_start(int (*client)(int fd, void *arg), void *arg, int *fd);
+/* Return 0 if the client process succeeded */
+int client_wait(pid_t pid);
+
+/* Send CMD and wait for OKAY or DATA, the reply being left in RESP.
+ * The INFO lines are counted in *INFOS and printed if VERBOSE. */
+int client_command(int fd, const char *cmd, char *resp, unsigned *infos, int verbose);
+/* Download SIZE bytes of DATA, taking *US if not NULL */
+int client_download(int fd, const void *data, unsigned size, unsigned long long *us);
+int client_download_file(int fd, const char *path);
+/* Run the commands of a command line, @FILE downloading FILE */
+int client_run(int fd, int argc, char **argv);
+
+/* Fill DATA with data that does not compress */
+void client_random(void *data, unsigned long size, unsigned long long *state);
+/* Print "SIZE in TIME: THROUGHPUT", SIZE in KiB below 1 MiB */
+void client_print_rate(unsigned long long bytes, unsigned long long us);
+
+#endif	/* _HOST_CLIENT_H_ */
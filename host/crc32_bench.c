@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) 2026, agent
+ * All rights reserved.
+ *
+ * Authors: agent <agent@local>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "os.h"
+
+/* CRC32 engine micro-benchmark.  libfastboot/crc32.c is checked
+ * against a bit at a time reference, then crc32_update() is timed
+ * against the byte at a time table it replaces, and crc32_zeros()
+ * against feeding the zeros to crc32_update(). */
+
+/* crc32.h, with C library types */
+uint32_t crc32_update(uint32_t crc, const void *data, unsigned long len);
+uint32_t crc32_zeros(uint32_t crc, uint64_t len);
+
+static unsigned size_mib = 64;
+static unsigned rounds = 8;
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-s MiB] [-n rounds]\n"
+		"  -s  buffer size in MiB (default %u)\n"
+		"  -n  passes over the buffer to time (default %u)\n",
+		prog, size_mib, rounds);
+	exit(2);
+}
+
+static uint32_t crc32_bitwise(uint32_t crc, const uint8_t *data, unsigned long len)
+{
+	unsigned k;
+
+	crc = ~crc;
+	while (len--) {
+		crc ^= *data++;
+		for (k = 0; k < 8; k++)
+			crc = crc & 1 ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+	}
+	return ~crc;
+}
+
+static uint32_t bytewise_table[256];
+
+static uint32_t crc32_bytewise(uint32_t crc, const uint8_t *data, unsigned long len)
+{
+	crc = ~crc;
+	while (len--)
+		crc = bytewise_table[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+static void random_fill(void *data, unsigned long size)
+{
+	unsigned long long state = 88172645463325252ULL, *pos = data;
+	unsigned long i;
+
+	for (i = 0; i < size / sizeof(*pos); i++) {
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		pos[i] = state;
+	}
+}
+
+static int check(const uint8_t *data, const uint8_t *zeros, unsigned long size)
+{
+	static const uint64_t zero_lengths[] = { 0, 1, 3, 8, 511, 4096, 65537, 1048576 + 5 };
+	uint32_t expected, crc;
+	unsigned long len, offset, i;
+
+	if (crc32_update(0, "123456789", 9) != 0xcbf43926) {
+		fprintf(stderr, "crc32_update: wrong check value\n");
+		return -1;
+	}
+
+	/* Every alignment, short lengths and a few long ones */
+	for (offset = 0; offset < 8; offset++) {
+		for (len = 0; len < 1024 + 17 && offset + len <= size; len += len < 64 ? 1 : 61) {
+			expected = crc32_bitwise(0x12345678, data + offset, len);
+			crc = crc32_update(0x12345678, data + offset, len);
+			if (crc != expected) {
+				fprintf(stderr, "crc32_update: %08x instead of %08x at offset %lu, length %lu\n",
+					crc, expected, offset, len);
+				return -1;
+			}
+		}
+	}
+
+	/* The same CRC whatever the split */
+	len = size < 1048576 ? size : 1048576;
+	expected = crc32_bitwise(0, data, len);
+	for (i = 1; i < len; i = i * 3 + 1) {
+		crc = crc32_update(crc32_update(0, data, i), data + i, len - i);
+		if (crc != expected) {
+			fprintf(stderr, "crc32_update: wrong result split at %lu\n", i);
+			return -1;
+		}
+	}
+
+	for (i = 0; i < sizeof(zero_lengths) / sizeof(*zero_lengths); i++) {
+		if (zero_lengths[i] > size)
+			continue;
+		expected = crc32_bitwise(0xdeadbeef, zeros, zero_lengths[i]);
+		crc = crc32_zeros(0xdeadbeef, zero_lengths[i]);
+		if (crc != expected) {
+			fprintf(stderr, "crc32_zeros: %08x instead of %08x for %llu bytes\n",
+				crc, expected, (unsigned long long)zero_lengths[i]);
+			return -1;
+		}
+	}
+
+	printf("check        crc32_update and crc32_zeros match the bitwise reference\n");
+	return 0;
+}
+
+static void print_rate(const char *name, unsigned long long bytes, unsigned long long us)
+{
+	if (!us)
+		us = 1;
+	printf("%-12s %llu MiB in %llu.%03llu s: %llu.%02llu MiB/s\n", name, bytes >> 20,
+	       us / 1000000, us / 1000 % 1000,
+	       bytes * 1000000 / us >> 20, (bytes * 1000000 / us * 100 >> 20) % 100);
+}
+
+static void bench_update(const uint8_t *data, unsigned long size)
+{
+	unsigned long long start, us;
+	volatile uint32_t sink = 0;
+	unsigned i;
+
+	start = os_time_us();
+	for (i = 0; i < rounds; i++)
+		sink ^= crc32_update(sink, data, size);
+	us = os_time_us() - start;
+	print_rate("slice-by-8", (unsigned long long)rounds * size, us);
+
+	start = os_time_us();
+	for (i = 0; i < rounds; i++)
+		sink ^= crc32_bytewise(sink, data, size);
+	us = os_time_us() - start;
+	print_rate("byte-wise", (unsigned long long)rounds * size, us);
+}
+
+static void bench_zeros(const uint8_t *zeros, unsigned long size)
+{
+	static const uint64_t lengths[] = { 4096, 1048576, 1ULL << 30, 1ULL << 40 };
+	unsigned long long start, us, calls;
+	volatile uint32_t sink = 0;
+	unsigned i, j;
+
+	for (i = 0; i < sizeof(lengths) / sizeof(*lengths); i++) {
+		calls = 10000;
+		start = os_time_us();
+		for (j = 0; j < calls; j++)
+			sink ^= crc32_zeros(sink, lengths[i]);
+		us = os_time_us() - start;
+		printf("zeros        %llu KiB: %llu ns per call", (unsigned long long)lengths[i] >> 10,
+		       us * 1000 / calls);
+
+		if (lengths[i] <= size) {
+			start = os_time_us();
+			sink ^= crc32_update(sink, zeros, lengths[i]);
+			us = os_time_us() - start;
+			printf(", %llu ns with crc32_update", us * 1000);
+		}
+		printf("\n");
+	}
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long size;
+	uint8_t *data, *zeros;
+	uint32_t c;
+	int opt, i, k;
+
+	while ((opt = getopt(argc, argv, "s:n:h")) != -1) {
+		switch (opt) {
+		case 's':
+			size_mib = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			rounds = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!size_mib || !rounds)
+		usage(argv[0]);
+
+	for (i = 0; i < 256; i++) {
+		for (c = i, k = 0; k < 8; k++)
+			c = c & 1 ? (c >> 1) ^ 0xedb88320 : c >> 1;
+		bytewise_table[i] = c;
+	}
+
+	size = (unsigned long)size_mib << 20;
+	data = malloc(size);
+	zeros = calloc(1, size);
+	if (!data || !zeros) {
+		fprintf(stderr, "Failed to allocate %u MiB\n", size_mib);
+		return 1;
+	}
+	random_fill(data, size);
+
+	if (check(data, zeros, size))
+		return 1;
+	bench_update(data, size);
+	bench_zeros(zeros, size);
+
+	free(data);
+	free(zeros);
+	return 0;
+}
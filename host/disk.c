@@ -0,0 +1,396 @@
+/*
+ * Copyright (c) 2026, agent
+ * All rights reserved.
+ *
+ * Authors: agent <agent@local>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <efi.h>
+#include <efilib.h>
+#include <lib.h>
+
+#include "storage.h"
+#include "os.h"
+#include "host.h"
+#include "efi_host.h"
+
+/* Block device stand-in: Block I/O and Disk I/O, optionally Block
+ * I/O 2 and Erase Block, on a file or memory mapping.  The device
+ * handles one request at a time, each one taking the configured
+ * latency: a synchronous request waits for it, an asynchronous one
+ * signals its event when it is over. */
+
+#define DISK_MEDIA_ID 1
+#define ERASE_BLOCK_REVISION ((2 << 16) | 60)
+
+static EFI_GUID BlockIo2ProtocolGuid = EFI_BLOCK_IO2_PROTOCOL_GUID;
+static EFI_GUID EraseBlockProtocolGuid = EFI_ERASE_BLOCK_PROTOCOL_GUID;
+
+static struct host_disk {
+	EFI_BLOCK_IO_MEDIA media;
+	EFI_BLOCK_IO bio;
+	EFI_BLOCK_IO2_PROTOCOL bio2;
+	EFI_DISK_IO dio;
+	EFI_ERASE_BLOCK_PROTOCOL erase;
+	UINT8 *data;
+	UINT64 size;
+	BOOLEAN file;		/* DATA maps a file, to be synced on flush */
+	UINT64 latency_us;
+	UINT64 busy_until;	/* End of the last request */
+	VOID *bounce;		/* One block for the Disk I/O partial blocks */
+	struct host_disk_stats *stats;
+	struct host_disk_stats own_stats;
+} disk;
+
+/* Completion time of a request submitted now */
+static UINT64 disk_schedule(void)
+{
+	UINT64 now = os_time_us();
+
+	disk.busy_until = MAX(now, disk.busy_until) + disk.latency_us;
+	return disk.busy_until;
+}
+
+static void disk_wait(void)
+{
+	UINT64 end = disk_schedule(), now = os_time_us();
+
+	if (end > now)
+		os_sleep_us(end - now);
+}
+
+static EFI_STATUS disk_check(UINT32 media_id, EFI_LBA lba, UINTN size, VOID *buffer)
+{
+	if (media_id != disk.media.MediaId)
+		return EFI_MEDIA_CHANGED;
+	if (size % disk.media.BlockSize)
+		return EFI_BAD_BUFFER_SIZE;
+	if (lba > disk.media.LastBlock ||
+	    size / disk.media.BlockSize > disk.media.LastBlock + 1 - lba)
+		return EFI_INVALID_PARAMETER;
+	if (disk.media.IoAlign > 1 && (UINTN)buffer % disk.media.IoAlign) {
+		disk.stats->unaligned++;
+		return EFI_INVALID_PARAMETER;
+	}
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS disk_transfer(BOOLEAN write, UINT32 media_id, EFI_LBA lba,
+				UINTN size, VOID *buffer)
+{
+	UINT8 *pos = disk.data + lba * disk.media.BlockSize;
+	EFI_STATUS ret;
+
+	ret = disk_check(media_id, lba, size, buffer);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	if (write) {
+		os_copy(pos, buffer, size);
+		disk.stats->writes++;
+		disk.stats->write_bytes += size;
+	} else {
+		os_copy(buffer, pos, size);
+		disk.stats->reads++;
+		disk.stats->read_bytes += size;
+	}
+	return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS bio_reset(__attribute__((__unused__)) EFI_BLOCK_IO *this,
+				   __attribute__((__unused__)) BOOLEAN verify)
+{
+	return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS bio_read(__attribute__((__unused__)) EFI_BLOCK_IO *this,
+				  UINT32 media_id, EFI_LBA lba, UINTN size, VOID *buffer)
+{
+	EFI_STATUS ret;
+
+	ret = disk_transfer(FALSE, media_id, lba, size, buffer);
+	if (!EFI_ERROR(ret))
+		disk_wait();
+	return ret;
+}
+
+static EFIAPI EFI_STATUS bio_write(__attribute__((__unused__)) EFI_BLOCK_IO *this,
+				   UINT32 media_id, EFI_LBA lba, UINTN size, VOID *buffer)
+{
+	EFI_STATUS ret;
+
+	ret = disk_transfer(TRUE, media_id, lba, size, buffer);
+	if (!EFI_ERROR(ret))
+		disk_wait();
+	return ret;
+}
+
+static EFIAPI EFI_STATUS bio_flush(__attribute__((__unused__)) EFI_BLOCK_IO *this)
+{
+	disk.stats->flushes++;
+	if (disk.file && os_sync(disk.data, disk.size))
+		return EFI_DEVICE_ERROR;
+	return EFI_SUCCESS;
+}
+
+/* Complete a request of the asynchronous protocols, blocking when
+ * the caller gave no event */
+static EFI_STATUS request_complete(EFI_EVENT event, EFI_STATUS *status, EFI_STATUS ret)
+{
+	if (EFI_ERROR(ret))
+		return ret;
+
+	if (!event) {
+		disk_wait();
+		return EFI_SUCCESS;
+	}
+
+	*status = EFI_SUCCESS;
+	host_signal_at(event, disk_schedule());
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS bio2_complete(EFI_BLOCK_IO2_TOKEN *token, EFI_STATUS ret)
+{
+	if (!token)
+		return request_complete(NULL, NULL, ret);
+	return request_complete(token->Event, &token->TransactionStatus, ret);
+}
+
+static EFIAPI EFI_STATUS bio2_reset(__attribute__((__unused__)) EFI_BLOCK_IO2_PROTOCOL *this,
+				    __attribute__((__unused__)) BOOLEAN verify)
+{
+	return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS bio2_read(__attribute__((__unused__)) EFI_BLOCK_IO2_PROTOCOL *this,
+				   UINT32 media_id, EFI_LBA lba, EFI_BLOCK_IO2_TOKEN *token,
+				   UINTN size, VOID *buffer)
+{
+	return bio2_complete(token, disk_transfer(FALSE, media_id, lba, size, buffer));
+}
+
+static EFIAPI EFI_STATUS bio2_write(__attribute__((__unused__)) EFI_BLOCK_IO2_PROTOCOL *this,
+				    UINT32 media_id, EFI_LBA lba, EFI_BLOCK_IO2_TOKEN *token,
+				    UINTN size, VOID *buffer)
+{
+	return bio2_complete(token, disk_transfer(TRUE, media_id, lba, size, buffer));
+}
+
+static EFIAPI EFI_STATUS bio2_flush(__attribute__((__unused__)) EFI_BLOCK_IO2_PROTOCOL *this,
+				    EFI_BLOCK_IO2_TOKEN *token)
+{
+	return bio2_complete(token, bio_flush(&disk.bio));
+}
+
+/* Disk I/O on top of Block I/O, like the firmware driver: the
+ * partial blocks at both ends go through a bounce block, read then
+ * written back for a write, as well as the whole request when the
+ * buffer does not meet IoAlign. */
+static EFI_STATUS dio_partial(BOOLEAN write, UINT64 offset, UINTN size, UINT8 *buffer)
+{
+	UINT32 block_size = disk.media.BlockSize;
+	EFI_LBA lba = offset / block_size;
+	UINT8 *pos = (UINT8 *)disk.bounce + offset % block_size;
+	EFI_STATUS ret;
+
+	ret = bio_read(&disk.bio, disk.media.MediaId, lba, block_size, disk.bounce);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	if (!write) {
+		os_copy(buffer, pos, size);
+		return EFI_SUCCESS;
+	}
+
+	os_copy(pos, buffer, size);
+	return bio_write(&disk.bio, disk.media.MediaId, lba, block_size, disk.bounce);
+}
+
+static EFI_STATUS dio_transfer(BOOLEAN write, UINT32 media_id, UINT64 offset,
+			       UINTN size, UINT8 *buffer)
+{
+	UINT32 block_size = disk.media.BlockSize;
+	BOOLEAN aligned;
+	UINTN len;
+	EFI_STATUS ret;
+
+	if (media_id != disk.media.MediaId)
+		return EFI_MEDIA_CHANGED;
+	if (offset > disk.size || size > disk.size - offset)
+		return EFI_INVALID_PARAMETER;
+
+	while (size) {
+		/* The buffer moves on by the size of a partial head */
+		aligned = disk.media.IoAlign <= 1 || !((UINTN)buffer % disk.media.IoAlign);
+		len = MIN(size, block_size - offset % block_size);
+		if (len == block_size && aligned) {
+			len = size - size % block_size;
+			if (write)
+				ret = bio_write(&disk.bio, media_id, offset / block_size, len, buffer);
+			else
+				ret = bio_read(&disk.bio, media_id, offset / block_size, len, buffer);
+		} else
+			ret = dio_partial(write, offset, len, buffer);
+		if (EFI_ERROR(ret))
+			return ret;
+
+		offset += len;
+		buffer += len;
+		size -= len;
+	}
+
+	return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS dio_read(__attribute__((__unused__)) EFI_DISK_IO *this,
+				  UINT32 media_id, UINT64 offset, UINTN size, VOID *buffer)
+{
+	return dio_transfer(FALSE, media_id, offset, size, buffer);
+}
+
+static EFIAPI EFI_STATUS dio_write(__attribute__((__unused__)) EFI_DISK_IO *this,
+				   UINT32 media_id, UINT64 offset, UINTN size, VOID *buffer)
+{
+	return dio_transfer(TRUE, media_id, offset, size, buffer);
+}
+
+/* Erased blocks read back as zeros */
+static EFIAPI EFI_STATUS erase_blocks(__attribute__((__unused__)) EFI_ERASE_BLOCK_PROTOCOL *this,
+				      UINT32 media_id, EFI_LBA lba,
+				      EFI_ERASE_BLOCK_TOKEN *token, UINTN size)
+{
+	EFI_STATUS ret;
+
+	ret = disk_check(media_id, lba, size, NULL);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	os_fill(disk.data + lba * disk.media.BlockSize, 0, size);
+	disk.stats->erases++;
+	disk.stats->erase_bytes += size;
+
+	if (!token)
+		return request_complete(NULL, NULL, EFI_SUCCESS);
+	return request_complete(token->Event, &token->TransactionStatus, EFI_SUCCESS);
+}
+
+int host_disk_attach(const struct host_disk_config *config)
+{
+	unsigned long long size;
+	EFI_HANDLE handle = NULL;
+	EFI_STATUS ret;
+
+	if (!config->block_size || config->block_size % 512) {
+		error(L"Invalid block size %d", config->block_size);
+		return -1;
+	}
+	/* The bounce block is page aligned */
+	if (config->io_align & (config->io_align - 1) || config->io_align > EFI_PAGE_SIZE) {
+		error(L"Invalid IoAlign %d", config->io_align);
+		return -1;
+	}
+
+	size = config->size;
+	disk.file = config->path != NULL;
+	if (config->path)
+		disk.data = os_map_file(config->path, &size);
+	else
+		disk.data = os_map_anon(size);
+	disk.size = size;
+	if (!disk.data || disk.size < config->block_size) {
+		error(L"Failed to map the disk image");
+		return -1;
+	}
+
+	disk.bounce = os_map_anon(config->block_size);
+	if (!disk.bounce) {
+		error(L"Failed to allocate the bounce block");
+		return -1;
+	}
+
+	disk.stats = config->stats ? config->stats : &disk.own_stats;
+	disk.latency_us = config->latency_us;
+
+	disk.media.MediaId = DISK_MEDIA_ID;
+	disk.media.MediaPresent = TRUE;
+	disk.media.BlockSize = config->block_size;
+	disk.media.IoAlign = config->io_align;
+	disk.media.LastBlock = disk.size / config->block_size - 1;
+
+	disk.bio.Revision = EFI_BLOCK_IO_INTERFACE_REVISION;
+	disk.bio.Media = &disk.media;
+	disk.bio.Reset = bio_reset;
+	disk.bio.ReadBlocks = bio_read;
+	disk.bio.WriteBlocks = bio_write;
+	disk.bio.FlushBlocks = bio_flush;
+
+	disk.dio.Revision = EFI_DISK_IO_INTERFACE_REVISION;
+	disk.dio.ReadDisk = dio_read;
+	disk.dio.WriteDisk = dio_write;
+
+	ret = uefi_call_wrapper(BS->InstallProtocolInterface, 4, &handle,
+				&BlockIoProtocol, EFI_NATIVE_INTERFACE, &disk.bio);
+	if (!EFI_ERROR(ret))
+		ret = uefi_call_wrapper(BS->InstallProtocolInterface, 4, &handle,
+					&DiskIoProtocol, EFI_NATIVE_INTERFACE, &disk.dio);
+
+	if (!EFI_ERROR(ret) && config->block_io2) {
+		disk.bio2.Media = &disk.media;
+		disk.bio2.Reset = bio2_reset;
+		disk.bio2.ReadBlocksEx = bio2_read;
+		disk.bio2.WriteBlocksEx = bio2_write;
+		disk.bio2.FlushBlocksEx = bio2_flush;
+		ret = uefi_call_wrapper(BS->InstallProtocolInterface, 4, &handle,
+					&BlockIo2ProtocolGuid, EFI_NATIVE_INTERFACE,
+					&disk.bio2);
+	}
+
+	if (!EFI_ERROR(ret) && config->erase_block) {
+		disk.erase.Revision = ERASE_BLOCK_REVISION;
+		disk.erase.EraseLengthGranularity = 1;
+		disk.erase.EraseBlocks = erase_blocks;
+		ret = uefi_call_wrapper(BS->InstallProtocolInterface, 4, &handle,
+					&EraseBlockProtocolGuid, EFI_NATIVE_INTERFACE,
+					&disk.erase);
+	}
+
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to install the disk protocols");
+		return -1;
+	}
+
+	return 0;
+}
+
+int host_disk_sync(void)
+{
+	if (!disk.file)
+		return 0;
+	return os_sync(disk.data, disk.size);
+}
@@ -0,0 +1,861 @@
+/*
+ * Copyright (c) 2026, agent
+ * All rights reserved.
+ *
+ * Authors: agent <agent@local>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <efi.h>
+#include <efilib.h>
+
+#include "os.h"
+#include "host.h"
+#include "efi_host.h"
+
+/* Firmware services for the host harness: handle database, events,
+ * memory, variables and console.  Only what libfastboot and the EFI
+ * library use is implemented, the other services fail. */
+
+#define MAX_HANDLES 32
+#define MAX_PROTOCOLS 8
+
+struct host_handle {
+	BOOLEAN used;
+	UINTN count;
+	struct {
+		EFI_GUID guid;
+		VOID *interface;
+	} protocols[MAX_PROTOCOLS];
+};
+
+static struct host_handle handles[MAX_HANDLES];
+
+static struct host_handle *handle_get(EFI_HANDLE handle)
+{
+	struct host_handle *h = handle;
+
+	if (h < handles || h >= handles + MAX_HANDLES || !h->used)
+		return NULL;
+	return h;
+}
+
+static VOID **handle_find(struct host_handle *h, EFI_GUID *guid)
+{
+	UINTN i;
+
+	for (i = 0; i < h->count; i++)
+		if (!CompareGuid(&h->protocols[i].guid, guid))
+			return &h->protocols[i].interface;
+	return NULL;
+}
+
+static EFIAPI EFI_STATUS install_protocol(EFI_HANDLE *handle, EFI_GUID *guid,
+					  EFI_INTERFACE_TYPE type, VOID *interface)
+{
+	struct host_handle *h;
+	UINTN i;
+
+	if (type != EFI_NATIVE_INTERFACE)
+		return EFI_INVALID_PARAMETER;
+
+	if (*handle) {
+		h = handle_get(*handle);
+		if (!h)
+			return EFI_INVALID_PARAMETER;
+	} else {
+		for (i = 0; i < MAX_HANDLES && handles[i].used; i++)
+			;
+		if (i == MAX_HANDLES)
+			return EFI_OUT_OF_RESOURCES;
+		h = &handles[i];
+		h->used = TRUE;
+		h->count = 0;
+	}
+
+	if (handle_find(h, guid))
+		return EFI_INVALID_PARAMETER;
+	if (h->count == MAX_PROTOCOLS)
+		return EFI_OUT_OF_RESOURCES;
+
+	h->protocols[h->count].guid = *guid;
+	h->protocols[h->count].interface = interface;
+	h->count++;
+	*handle = h;
+	return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS reinstall_protocol(EFI_HANDLE handle, EFI_GUID *guid,
+					    VOID *old, VOID *new)
+{
+	struct host_handle *h = handle_get(handle);
+	VOID **interface;
+
+	if (!h)
+		return EFI_INVALID_PARAMETER;
+	interface = handle_find(h, guid);
+	if (!interface || *interface != old)
+		return EFI_NOT_FOUND;
+
+	*interface = new;
+	return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS uninstall_protocol(EFI_HANDLE handle, EFI_GUID *guid,
+					    VOID *interface)
+{
+	struct host_handle *h = handle_get(handle);
+	UINTN i;
+
+	if (!h)
+		return EFI_INVALID_PARAMETER;
+
+	for (i = 0; i < h->count; i++) {
+		if (CompareGuid(&h->protocols[i].guid, guid) ||
+		    h->protocols[i].interface != interface)
+			continue;
+		h->protocols[i] = h->protocols[--h->count];
+		if (!h->count)
+			h->used = FALSE;
+		return EFI_SUCCESS;
+	}
+
+	return EFI_NOT_FOUND;
+}
+
+static EFIAPI EFI_STATUS handle_protocol(EFI_HANDLE handle, EFI_GUID *guid,
+					 VOID **interface)
+{
+	struct host_handle *h = handle_get(handle);
+	VOID **found;
+
+	if (!h)
+		return EFI_INVALID_PARAMETER;
+	found = handle_find(h, guid);
+	if (!found)
+		return EFI_UNSUPPORTED;
+
+	*interface = *found;
+	return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS open_protocol(EFI_HANDLE handle, EFI_GUID *guid,
+				       VOID **interface,
+				       __attribute__((__unused__)) EFI_HANDLE agent,
+				       __attribute__((__unused__)) EFI_HANDLE controller,
+				       __attribute__((__unused__)) UINT32 attributes)
+{
+	return handle_protocol(handle, guid, interface);
+}
+
+static EFIAPI EFI_STATUS close_protocol(__attribute__((__unused__)) EFI_HANDLE handle,
+					__attribute__((__unused__)) EFI_GUID *guid,
+					__attribute__((__unused__)) EFI_HANDLE agent,
+					__attribute__((__unused__)) EFI_HANDLE controller)
+{
+	return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS locate_handle(EFI_LOCATE_SEARCH_TYPE type, EFI_GUID *guid,
+				       __attribute__((__unused__)) VOID *key,
+				       UINTN *size, EFI_HANDLE *buffer)
+{
+	UINTN i, count = 0;
+
+	if (type != AllHandles && type != ByProtocol)
+		return EFI_UNSUPPORTED;
+
+	for (i = 0; i < MAX_HANDLES; i++) {
+		if (!handles[i].used)
+			continue;
+		if (type == ByProtocol && !handle_find(&handles[i], guid))
+			continue;
+		if ((count + 1) * sizeof(EFI_HANDLE) <= *size)
+			buffer[count] = &handles[i];
+		count++;
+	}
+
+	if (!count)
+		return EFI_NOT_FOUND;
+	if (count * sizeof(EFI_HANDLE) > *size) {
+		*size = count * sizeof(EFI_HANDLE);
+		return EFI_BUFFER_TOO_SMALL;
+	}
+
+	*size = count * sizeof(EFI_HANDLE);
+	return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS locate_handle_buffer(EFI_LOCATE_SEARCH_TYPE type, EFI_GUID *guid,
+					      VOID *key, UINTN *count, EFI_HANDLE **buffer)
+{
+	UINTN size = 0;
+	EFI_STATUS ret;
+
+	ret = locate_handle(type, guid, key, &size, NULL);
+	if (ret != EFI_BUFFER_TOO_SMALL)
+		return ret;
+
+	*buffer = AllocatePool(size);
+	if (!*buffer)
+		return EFI_OUT_OF_RESOURCES;
+
+	locate_handle(type, guid, key, &size, *buffer);
+	*count = size / sizeof(EFI_HANDLE);
+	return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS locate_protocol(EFI_GUID *guid,
+					 __attribute__((__unused__)) VOID *registration,
+					 VOID **interface)
+{
+	UINTN i;
+
+	for (i = 0; i < MAX_HANDLES; i++)
+		if (handles[i].used && !handle_protocol(&handles[i], guid, interface))
+			return EFI_SUCCESS;
+
+	return EFI_NOT_FOUND;
+}
+
+/* Events.  A timer or a completion deadline is checked each time the
+ * event is checked or waited for. */
+struct host_event {
+	UINT32 type;
+	EFI_EVENT_NOTIFY notify;
+	VOID *context;
+	BOOLEAN signaled;
+	UINT64 deadline_us;
+	UINT64 period_us;
+};
+
+static EFIAPI EFI_STATUS signal_event(EFI_EVENT event)
+{
+	struct host_event *e = event;
+
+	e->signaled = TRUE;
+	if ((e->type & EVT_NOTIFY_SIGNAL) && e->notify)
+		e->notify(event, e->context);
+	return EFI_SUCCESS;
+}
+
+static void event_update(struct host_event *e)
+{
+	if (!e->deadline_us || os_time_us() < e->deadline_us)
+		return;
+
+	e->deadline_us = e->period_us ? e->deadline_us + e->period_us : 0;
+	signal_event(e);
+}
+
+static EFIAPI EFI_STATUS create_event(UINT32 type,
+				      __attribute__((__unused__)) EFI_TPL tpl,
+				      EFI_EVENT_NOTIFY notify, VOID *context,
+				      EFI_EVENT *event)
+{
+	struct host_event *e;
+
+	e = os_malloc(sizeof(*e));
+	if (!e)
+		return EFI_OUT_OF_RESOURCES;
+
+	ZeroMem(e, sizeof(*e));
+	e->type = type;
+	e->notify = notify;
+	e->context = context;
+	*event = e;
+	return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS close_event(EFI_EVENT event)
+{
+	os_free(event);
+	return EFI_SUCCESS;
+}
+
+/* TriggerTime is in 100 ns units */
+static EFIAPI EFI_STATUS set_timer(EFI_EVENT event, EFI_TIMER_DELAY type, UINT64 time)
+{
+	struct host_event *e = event;
+	UINT64 us = time / 10;
+
+	switch (type) {
+	case TimerCancel:
+		e->deadline_us = 0;
+		e->period_us = 0;
+		break;
+	case TimerPeriodic:
+		e->period_us = us ? us : 1;
+		e->deadline_us = os_time_us() + e->period_us;
+		break;
+	case TimerRelative:
+		e->period_us = 0;
+		e->deadline_us = os_time_us() + us;
+		break;
+	default:
+		return EFI_INVALID_PARAMETER;
+	}
+
+	return EFI_SUCCESS;
+}
+
+void host_signal_at(EFI_EVENT event, UINT64 us)
+{
+	struct host_event *e = event;
+
+	e->period_us = 0;
+	e->deadline_us = us ? us : 1;
+}
+
+static EFIAPI EFI_STATUS check_event(EFI_EVENT event)
+{
+	struct host_event *e = event;
+
+	event_update(e);
+	if (!e->signaled)
+		return EFI_NOT_READY;
+
+	e->signaled = FALSE;
+	return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS wait_for_event(UINTN count, EFI_EVENT *events, UINTN *index)
+{
+	struct host_event *e;
+	UINT64 next, now;
+	UINTN i;
+
+	for (;;) {
+		next = 0;
+		for (i = 0; i < count; i++) {
+			e = events[i];
+			if (!check_event(e)) {
+				*index = i;
+				return EFI_SUCCESS;
+			}
+			if (e->deadline_us && (!next || e->deadline_us < next))
+				next = e->deadline_us;
+		}
+
+		/* Nothing would ever signal these events */
+		if (!next)
+			return EFI_UNSUPPORTED;
+
+		now = os_time_us();
+		if (next > now)
+			os_sleep_us(next - now);
+	}
+}
+
+static EFIAPI EFI_TPL raise_tpl(__attribute__((__unused__)) EFI_TPL tpl)
+{
+	return TPL_APPLICATION;
+}
+
+static EFIAPI VOID restore_tpl(__attribute__((__unused__)) EFI_TPL tpl)
+{
+}
+
+/* Memory.  Pages are anonymous mappings so that any of them can be
+ * given back, as storage_alloc() does. */
+static EFIAPI EFI_STATUS allocate_pool(__attribute__((__unused__)) EFI_MEMORY_TYPE type,
+				       UINTN size, VOID **buffer)
+{
+	*buffer = os_malloc(size);
+	return *buffer ? EFI_SUCCESS : EFI_OUT_OF_RESOURCES;
+}
+
+static EFIAPI EFI_STATUS free_pool(VOID *buffer)
+{
+	os_free(buffer);
+	return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS allocate_pages(EFI_ALLOCATE_TYPE type,
+					__attribute__((__unused__)) EFI_MEMORY_TYPE memory_type,
+					UINTN pages, EFI_PHYSICAL_ADDRESS *memory)
+{
+	VOID *addr;
+
+	if (type == AllocateAddress)
+		return EFI_UNSUPPORTED;
+
+	addr = os_map_anon((UINT64)pages * EFI_PAGE_SIZE);
+	if (!addr)
+		return EFI_OUT_OF_RESOURCES;
+	if (type == AllocateMaxAddress &&
+	    (UINTN)addr + pages * EFI_PAGE_SIZE - 1 > *memory) {
+		os_unmap(addr, (UINT64)pages * EFI_PAGE_SIZE);
+		return EFI_OUT_OF_RESOURCES;
+	}
+
+	*memory = (UINTN)addr;
+	return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS free_pages(EFI_PHYSICAL_ADDRESS memory, UINTN pages)
+{
+	os_unmap((VOID *)(UINTN)memory, (UINT64)pages * EFI_PAGE_SIZE);
+	return EFI_SUCCESS;
+}
+
+/* A single conventional memory range, as large as the free memory */
+static EFIAPI EFI_STATUS get_memory_map(UINTN *size, EFI_MEMORY_DESCRIPTOR *map,
+					UINTN *key, UINTN *desc_size, UINT32 *desc_version)
+{
+	*desc_size = sizeof(*map);
+	*desc_version = 1;
+	*key = 0;
+	if (*size < sizeof(*map)) {
+		*size = sizeof(*map);
+		return EFI_BUFFER_TOO_SMALL;
+	}
+
+	ZeroMem(map, sizeof(*map));
+	map->Type = EfiConventionalMemory;
+	map->PhysicalStart = 0x100000;
+	map->NumberOfPages = os_free_memory() / EFI_PAGE_SIZE;
+	*size = sizeof(*map);
+	return EFI_SUCCESS;
+}
+
+static EFIAPI VOID copy_mem(VOID *dst, VOID *src, UINTN size)
+{
+	UINT8 *d = dst, *s = src;
+
+	if (d < s) {
+		while (size--)
+			*d++ = *s++;
+	} else {
+		while (size--)
+			d[size] = s[size];
+	}
+}
+
+static EFIAPI VOID set_mem(VOID *buffer, UINTN size, UINT8 value)
+{
+	UINT8 *b = buffer;
+
+	while (size--)
+		*b++ = value;
+}
+
+static EFIAPI EFI_STATUS calculate_crc32(VOID *data, UINTN size, UINT32 *crc)
+{
+	UINT8 *p = data;
+	UINT32 c = 0xFFFFFFFF;
+	UINTN i;
+
+	while (size--) {
+		c ^= *p++;
+		for (i = 0; i < 8; i++)
+			c = (c >> 1) ^ (0xEDB88320 & -(c & 1));
+	}
+
+	*crc = ~c;
+	return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS stall(UINTN us)
+{
+	os_sleep_us(us);
+	return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS set_watchdog_timer(__attribute__((__unused__)) UINTN timeout,
+					    __attribute__((__unused__)) UINT64 code,
+					    __attribute__((__unused__)) UINTN size,
+					    __attribute__((__unused__)) CHAR16 *data)
+{
+	return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS get_next_monotonic_count(UINT64 *count)
+{
+	static UINT64 counter;
+
+	*count = counter++;
+	return EFI_SUCCESS;
+}
+
+/* Variables, kept in memory for the life of the program */
+struct host_variable {
+	struct host_variable *next;
+	EFI_GUID guid;
+	UINT32 attributes;
+	UINTN size;
+	UINT8 *data;
+	CHAR16 *name;
+};
+
+static struct host_variable *variables;
+
+static struct host_variable **variable_find(CHAR16 *name, EFI_GUID *guid)
+{
+	struct host_variable **v;
+
+	for (v = &variables; *v; v = &(*v)->next)
+		if (!StrCmp((*v)->name, name) && !CompareGuid(&(*v)->guid, guid))
+			return v;
+	return NULL;
+}
+
+static EFIAPI EFI_STATUS get_variable(CHAR16 *name, EFI_GUID *guid, UINT32 *attributes,
+				      UINTN *size, VOID *data)
+{
+	struct host_variable **v = variable_find(name, guid);
+
+	if (!v)
+		return EFI_NOT_FOUND;
+
+	if (attributes)
+		*attributes = (*v)->attributes;
+	if (*size < (*v)->size || !data) {
+		*size = (*v)->size;
+		return EFI_BUFFER_TOO_SMALL;
+	}
+
+	CopyMem(data, (*v)->data, (*v)->size);
+	*size = (*v)->size;
+	return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS set_variable(CHAR16 *name, EFI_GUID *guid, UINT32 attributes,
+				      UINTN size, VOID *data)
+{
+	struct host_variable **v = variable_find(name, guid);
+	struct host_variable *var;
+	UINTN name_size = StrSize(name);
+
+	if (v) {
+		var = *v;
+		*v = var->next;
+		os_free(var);
+	}
+	if (!size)
+		return v ? EFI_SUCCESS : EFI_NOT_FOUND;
+
+	/* Name and data are stored after the structure */
+	var = os_malloc(sizeof(*var) + name_size + size);
+	if (!var)
+		return EFI_OUT_OF_RESOURCES;
+
+	var->guid = *guid;
+	var->attributes = attributes;
+	var->size = size;
+	var->name = (CHAR16 *)&var[1];
+	var->data = (UINT8 *)var->name + name_size;
+	CopyMem(var->name, name, name_size);
+	CopyMem(var->data, data, size);
+	var->next = variables;
+	variables = var;
+	return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS get_next_variable_name(UINTN *size, CHAR16 *name, EFI_GUID *guid)
+{
+	struct host_variable *var = variables;
+	struct host_variable **v;
+
+	if (name[0]) {
+		v = variable_find(name, guid);
+		if (!v)
+			return EFI_INVALID_PARAMETER;
+		var = (*v)->next;
+	}
+	if (!var)
+		return EFI_NOT_FOUND;
+
+	if (*size < StrSize(var->name)) {
+		*size = StrSize(var->name);
+		return EFI_BUFFER_TOO_SMALL;
+	}
+
+	CopyMem(name, var->name, StrSize(var->name));
+	*guid = var->guid;
+	return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS get_time(EFI_TIME *time,
+				  __attribute__((__unused__)) EFI_TIME_CAPABILITIES *capabilities)
+{
+	unsigned year, month, day, hour, minute, second;
+
+	os_localtime(&year, &month, &day, &hour, &minute, &second);
+	ZeroMem(time, sizeof(*time));
+	time->Year = year;
+	time->Month = month;
+	time->Day = day;
+	time->Hour = hour;
+	time->Minute = minute;
+	time->Second = second;
+	return EFI_SUCCESS;
+}
+
+static EFIAPI VOID reset_system(EFI_RESET_TYPE type, EFI_STATUS status,
+				__attribute__((__unused__)) UINTN size,
+				__attribute__((__unused__)) CHAR16 *data)
+{
+	Print(L"Reset requested, type %d: %r\n", type, status);
+	os_exit(EFI_ERROR(status) ? 1 : 0);
+}
+
+/* Console.  Output goes to the standard output, there is no input. */
+static EFIAPI EFI_STATUS output_string(__attribute__((__unused__)) SIMPLE_TEXT_OUTPUT_INTERFACE *this,
+				       CHAR16 *str)
+{
+	char buf[256];
+	UINTN len = 0;
+
+	for (; *str; str++) {
+		if (len + 3 > sizeof(buf)) {
+			os_print(buf, len);
+			len = 0;
+		}
+		if (*str == '\r')
+			continue;
+		if (*str < 0x80) {
+			buf[len++] = *str;
+		} else if (*str < 0x800) {
+			buf[len++] = 0xC0 | (*str >> 6);
+			buf[len++] = 0x80 | (*str & 0x3F);
+		} else {
+			buf[len++] = 0xE0 | (*str >> 12);
+			buf[len++] = 0x80 | ((*str >> 6) & 0x3F);
+			buf[len++] = 0x80 | (*str & 0x3F);
+		}
+	}
+
+	os_print(buf, len);
+	return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS text_reset(__attribute__((__unused__)) SIMPLE_TEXT_OUTPUT_INTERFACE *this,
+				    __attribute__((__unused__)) BOOLEAN extended)
+{
+	return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS test_string(__attribute__((__unused__)) SIMPLE_TEXT_OUTPUT_INTERFACE *this,
+				     __attribute__((__unused__)) CHAR16 *str)
+{
+	return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS query_mode(__attribute__((__unused__)) SIMPLE_TEXT_OUTPUT_INTERFACE *this,
+				    UINTN mode, UINTN *columns, UINTN *rows)
+{
+	if (mode)
+		return EFI_UNSUPPORTED;
+
+	*columns = 80;
+	*rows = 25;
+	return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS set_mode(__attribute__((__unused__)) SIMPLE_TEXT_OUTPUT_INTERFACE *this,
+				  UINTN mode)
+{
+	return mode ? EFI_UNSUPPORTED : EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS set_attribute(__attribute__((__unused__)) SIMPLE_TEXT_OUTPUT_INTERFACE *this,
+				       __attribute__((__unused__)) UINTN attribute)
+{
+	return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS clear_screen(__attribute__((__unused__)) SIMPLE_TEXT_OUTPUT_INTERFACE *this)
+{
+	return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS set_cursor_position(__attribute__((__unused__)) SIMPLE_TEXT_OUTPUT_INTERFACE *this,
+					     __attribute__((__unused__)) UINTN column,
+					     __attribute__((__unused__)) UINTN row)
+{
+	return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS enable_cursor(__attribute__((__unused__)) SIMPLE_TEXT_OUTPUT_INTERFACE *this,
+				       __attribute__((__unused__)) BOOLEAN enable)
+{
+	return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS input_reset(__attribute__((__unused__)) SIMPLE_INPUT_INTERFACE *this,
+				     __attribute__((__unused__)) BOOLEAN extended)
+{
+	return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS read_key_stroke(__attribute__((__unused__)) SIMPLE_INPUT_INTERFACE *this,
+					 __attribute__((__unused__)) EFI_INPUT_KEY *key)
+{
+	return EFI_NOT_READY;
+}
+
+/* The remaining services are not available on the host */
+static EFIAPI EFI_STATUS locate_device_path(__attribute__((__unused__)) EFI_GUID *guid,
+					    __attribute__((__unused__)) EFI_DEVICE_PATH **path,
+					    __attribute__((__unused__)) EFI_HANDLE *device)
+{
+	return EFI_NOT_FOUND;
+}
+
+static EFIAPI EFI_STATUS load_image(__attribute__((__unused__)) BOOLEAN policy,
+				    __attribute__((__unused__)) EFI_HANDLE parent,
+				    __attribute__((__unused__)) EFI_DEVICE_PATH *path,
+				    __attribute__((__unused__)) VOID *buffer,
+				    __attribute__((__unused__)) UINTN size,
+				    __attribute__((__unused__)) EFI_HANDLE *image)
+{
+	return EFI_UNSUPPORTED;
+}
+
+static EFIAPI EFI_STATUS start_image(__attribute__((__unused__)) EFI_HANDLE image,
+				     __attribute__((__unused__)) UINTN *size,
+				     __attribute__((__unused__)) CHAR16 **data)
+{
+	return EFI_UNSUPPORTED;
+}
+
+static EFIAPI EFI_STATUS exit_image(__attribute__((__unused__)) EFI_HANDLE image,
+				    EFI_STATUS status,
+				    __attribute__((__unused__)) UINTN size,
+				    __attribute__((__unused__)) CHAR16 *data)
+{
+	os_exit(EFI_ERROR(status) ? 1 : 0);
+	return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS exit_boot_services(__attribute__((__unused__)) EFI_HANDLE image,
+					    __attribute__((__unused__)) UINTN key)
+{
+	return EFI_UNSUPPORTED;
+}
+
+static SIMPLE_TEXT_OUTPUT_MODE conout_mode = {
+	.MaxMode = 1,
+	.Attribute = EFI_TEXT_ATTR(EFI_LIGHTGRAY, EFI_BACKGROUND_BLACK),
+};
+
+static SIMPLE_TEXT_OUTPUT_INTERFACE conout = {
+	.Reset = text_reset,
+	.OutputString = output_string,
+	.TestString = test_string,
+	.QueryMode = query_mode,
+	.SetMode = set_mode,
+	.SetAttribute = set_attribute,
+	.ClearScreen = clear_screen,
+	.SetCursorPosition = set_cursor_position,
+	.EnableCursor = enable_cursor,
+	.Mode = &conout_mode
+};
+
+static SIMPLE_INPUT_INTERFACE conin = {
+	.Reset = input_reset,
+	.ReadKeyStroke = read_key_stroke
+};
+
+static EFI_BOOT_SERVICES boot_services = {
+	.RaiseTPL = raise_tpl,
+	.RestoreTPL = restore_tpl,
+	.AllocatePages = allocate_pages,
+	.FreePages = free_pages,
+	.GetMemoryMap = get_memory_map,
+	.AllocatePool = allocate_pool,
+	.FreePool = free_pool,
+	.CreateEvent = create_event,
+	.SetTimer = set_timer,
+	.WaitForEvent = wait_for_event,
+	.SignalEvent = signal_event,
+	.CloseEvent = close_event,
+	.CheckEvent = check_event,
+	.InstallProtocolInterface = install_protocol,
+	.ReinstallProtocolInterface = reinstall_protocol,
+	.UninstallProtocolInterface = uninstall_protocol,
+	.HandleProtocol = handle_protocol,
+	.LocateHandle = locate_handle,
+	.LocateDevicePath = locate_device_path,
+	.LoadImage = load_image,
+	.StartImage = start_image,
+	.Exit = exit_image,
+	.ExitBootServices = exit_boot_services,
+	.GetNextMonotonicCount = get_next_monotonic_count,
+	.Stall = stall,
+	.SetWatchdogTimer = set_watchdog_timer,
+	.OpenProtocol = open_protocol,
+	.CloseProtocol = close_protocol,
+	.LocateHandleBuffer = locate_handle_buffer,
+	.LocateProtocol = locate_protocol,
+	.CalculateCrc32 = calculate_crc32,
+	.CopyMem = copy_mem,
+	.SetMem = set_mem
+};
+
+static EFI_RUNTIME_SERVICES runtime_services = {
+	.GetTime = get_time,
+	.GetVariable = get_variable,
+	.GetNextVariableName = get_next_variable_name,
+	.SetVariable = set_variable,
+	.ResetSystem = reset_system
+};
+
+static EFI_SYSTEM_TABLE system_table = {
+	.FirmwareVendor = L"Linux host",
+	.ConIn = &conin,
+	.ConOut = &conout,
+	.StdErr = &conout,
+	.RuntimeServices = &runtime_services,
+	.BootServices = &boot_services
+};
+
+static EFI_LOADED_IMAGE loaded_image = {
+	.Revision = EFI_IMAGE_INFORMATION_REVISION,
+	.SystemTable = &system_table,
+	.ImageCodeType = EfiLoaderCode,
+	.ImageDataType = EfiLoaderData
+};
+
+int host_init(void)
+{
+	EFI_HANDLE image = NULL;
+	EFI_STATUS ret;
+
+	ret = create_event(0, TPL_APPLICATION, NULL, NULL, &conin.WaitForKey);
+	if (EFI_ERROR(ret))
+		return -1;
+
+	ret = install_protocol(&image, &LoadedImageProtocol,
+			       EFI_NATIVE_INTERFACE, &loaded_image);
+	if (EFI_ERROR(ret))
+		return -1;
+
+	InitializeLib(image, &system_table);
+	return 0;
+}
@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2026, agent
+ * All rights reserved.
+ *
+ * Authors: agent <agent@local>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <openssl/sha.h>
+
+#include "os.h"
+#include "host.h"
+#include "client.h"
+
+/* Fastboot protocol benchmark.  The fastboot state machine runs in
+ * this process on top of the USB stand-in, a forked client drives it
+ * through a socket pair: command round-trips, getvar:all, a download
+ * checked against download-sha256:0 and :1, then the commands of the
+ * command line and finally "continue". */
+
+static unsigned rounds = 200;
+static unsigned getvar_all_rounds = 10;
+static unsigned download_mib = 64;
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-n rounds] [-a rounds] [-s MiB] [-c KiB] [command ...]\n"
+		"  -n  getvar round-trips to time (default %u)\n"
+		"  -a  getvar:all to time (default %u)\n"
+		"  -s  download size in MiB, 0 to skip (default %u)\n"
+		"  -c  size of the host transfers in KiB (default %u)\n"
+		"Commands are sent after the benchmarks, @FILE downloads FILE.\n",
+		prog, rounds, getvar_all_rounds, download_mib, client_chunk / 1024);
+	exit(2);
+}
+
+static int check_sha256(int fd, const void *data, unsigned size)
+{
+	char resp[RESPONSE_LENGTH + 1], hex[2 * SHA256_DIGEST_LENGTH + 1];
+	char var[32];
+	unsigned char hash[SHA256_DIGEST_LENGTH];
+	unsigned i;
+
+	SHA256(data, size, hash);
+	for (i = 0; i < SHA256_DIGEST_LENGTH; i++)
+		sprintf(hex + 2 * i, "%02x", hash[i]);
+
+	/* The digest comes in two halves */
+	for (i = 0; i < 2; i++) {
+		snprintf(var, sizeof(var), "getvar:download-sha256:%u", i);
+		if (client_command(fd, var, resp, NULL, 1))
+			return -1;
+		if (strlen(resp + 4) != SHA256_DIGEST_LENGTH ||
+		    strncmp(resp + 4, hex + i * SHA256_DIGEST_LENGTH, SHA256_DIGEST_LENGTH)) {
+			fprintf(stderr, "download-sha256:%u %s, expected %.*s\n", i, resp + 4,
+				SHA256_DIGEST_LENGTH, hex + i * SHA256_DIGEST_LENGTH);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int bench_round_trip(int fd)
+{
+	char resp[RESPONSE_LENGTH + 1];
+	unsigned long long start, us, min = ~0ULL, max = 0, total = 0;
+	unsigned i;
+
+	for (i = 0; i < rounds; i++) {
+		start = os_time_us();
+		if (client_command(fd, "getvar:version-bootloader", resp, NULL, 1))
+			return -1;
+		us = os_time_us() - start;
+		total += us;
+		min = us < min ? us : min;
+		max = us > max ? us : max;
+	}
+
+	if (rounds)
+		printf("round-trip   %u x getvar:version-bootloader: avg %llu us, min %llu us, max %llu us\n",
+		       rounds, total / rounds, min, max);
+	return 0;
+}
+
+static int bench_getvar_all(int fd)
+{
+	char resp[RESPONSE_LENGTH + 1];
+	unsigned long long start, total = 0;
+	unsigned i, infos = 0;
+
+	for (i = 0; i < getvar_all_rounds; i++) {
+		start = os_time_us();
+		if (client_command(fd, "getvar:all", resp, &infos, 0))
+			return -1;
+		total += os_time_us() - start;
+	}
+
+	if (getvar_all_rounds)
+		printf("getvar:all   %u x %u variables: avg %llu.%03llu ms\n", getvar_all_rounds,
+		       infos, total / getvar_all_rounds / 1000, total / getvar_all_rounds % 1000);
+	return 0;
+}
+
+static int bench_download(int fd)
+{
+	unsigned long long us, state = 88172645463325252ULL;
+	unsigned size = download_mib * 1024 * 1024;
+	void *data;
+	int ret;
+
+	if (!size)
+		return 0;
+
+	data = malloc(size);
+	if (!data)
+		return -1;
+
+	client_random(data, size, &state);
+	ret = client_download(fd, data, size, &us);
+	if (!ret) {
+		printf("download     ");
+		client_print_rate(size, us);
+		ret = check_sha256(fd, data, size);
+	}
+
+	free(data);
+	return ret;
+}
+
+static int client(int fd, void *arg)
+{
+	char **argv = arg, resp[RESPONSE_LENGTH + 1];
+	int argc;
+
+	for (argc = 0; argv[argc]; argc++)
+		;
+
+	if (bench_round_trip(fd) || bench_getvar_all(fd) || bench_download(fd) ||
+	    client_run(fd, argc, argv))
+		return -1;
+
+	return client_command(fd, "continue", resp, NULL, 1);
+}
+
+int main(int argc, char **argv)
+{
+	int fd, opt, ret;
+	pid_t pid;
+
+	while ((opt = getopt(argc, argv, "n:a:s:c:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			rounds = strtoul(optarg, NULL, 0);
+			break;
+		case 'a':
+			getvar_all_rounds = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			download_mib = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			client_chunk = strtoul(optarg, NULL, 0) * 1024;
+			if (!client_chunk)
+				usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	pid = client_start(client, argv + optind, &fd);
+	if (pid < 0)
+		return 1;
+
+	ret = host_init() || host_usb_attach(fd) || host_fastboot_run();
+	close(fd);
+
+	if (client_wait(pid))
+		ret = 1;
+	return ret;
+}
@@ -0,0 +1,441 @@
+/*
+ * Copyright (c) 2026, agent
+ * All rights reserved.
+ *
+ * Authors: agent <agent@local>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "os.h"
+#include "host.h"
+#include "client.h"
+
+/* Storage benchmark.  Fastboot runs in this process on top of the
+ * USB and disk stand-ins, a forked client drives it: "flash:gpt"
+ * with a partition layout, a raw and a sparse image flashed to a
+ * partition, the erase of another one, then the commands of the
+ * command line and "oem storage-stats".  Each step reports its
+ * throughput and the I/Os the disk received. */
+
+#define GPT_BIN_MAGIC 0x6a8b0da1
+#define MAX_PARTS 64
+
+#define SPARSE_HEADER_MAGIC 0xed26ff3a
+#define SPARSE_BLOCK_SIZE 4096
+#define CHUNK_TYPE_RAW 0xCAC1
+#define CHUNK_TYPE_FILL 0xCAC2
+#define CHUNK_TYPE_DONT_CARE 0xCAC3
+#define CHUNK_TYPE_CRC32 0xCAC4
+
+/* gpt_bin.h and sparse_format.h, with C library types */
+struct guid {
+	uint32_t data1;
+	uint16_t data2;
+	uint16_t data3;
+	uint8_t data4[8];
+};
+
+struct gpt_bin_header {
+	uint32_t magic;
+	uint32_t start_lba;
+	uint32_t npart;
+};
+
+struct gpt_bin_part {
+	int32_t length;		/* In MiB, -1 for the rest of the disk */
+	uint16_t label[36];
+	struct guid type;
+	struct guid uuid;
+};
+
+struct sparse_header {
+	uint32_t magic;
+	uint16_t major_version;
+	uint16_t minor_version;
+	uint16_t file_hdr_sz;
+	uint16_t chunk_hdr_sz;
+	uint32_t blk_sz;
+	uint32_t total_blks;
+	uint32_t total_chunks;
+	uint32_t image_checksum;
+};
+
+struct chunk_header {
+	uint16_t chunk_type;
+	uint16_t reserved1;
+	uint32_t chunk_sz;
+	uint32_t total_sz;
+};
+
+static const struct guid linux_data = {
+	0x0fc63daf, 0x8483, 0x4772, { 0x8e, 0x79, 0x3d, 0x69, 0xd8, 0x47, 0x7d, 0xe4 }
+};
+
+static struct host_disk_config disk = {
+	.block_size = 512
+};
+static unsigned disk_mib;
+static unsigned image_mib = 128;
+static const char *layout = "boot:32,system:512,userdata:-1";
+static const char *flash_label = "system";
+static const char *erase_label = "userdata";
+static unsigned long long random_state = 88172645463325252ULL;
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [options] [command ...]\n"
+		"  -d FILE    disk image, memory if not given\n"
+		"  -S MiB     disk size (default 1024, or the size of FILE)\n"
+		"  -b bytes   block size (default %u)\n"
+		"  -A bytes   IoAlign (default %u)\n"
+		"  -l us      latency of each I/O (default %u)\n"
+		"  -2         provide Block I/O 2\n"
+		"  -e         provide Erase Block\n"
+		"  -g LAYOUT  label:MiB,... partitions, -1 for the rest (default %s)\n"
+		"  -s MiB     size of the raw and sparse images, 0 to skip (default %u)\n"
+		"  -p LABEL   partition to flash (default %s)\n"
+		"  -E LABEL   partition to erase, \"\" to skip (default %s)\n"
+		"  -c KiB     size of the host transfers (default %u)\n"
+		"Commands are sent after the benchmarks, @FILE downloads FILE.\n",
+		prog, disk.block_size, disk.io_align, disk.latency_us, layout,
+		image_mib, flash_label, erase_label, client_chunk / 1024);
+	exit(2);
+}
+
+static uint32_t crc32_table[256];
+
+static uint32_t crc32(uint32_t crc, const void *data, unsigned long size)
+{
+	const uint8_t *pos = data;
+	uint32_t c;
+	unsigned i, j;
+
+	if (!crc32_table[1]) {
+		for (i = 0; i < 256; i++) {
+			for (c = i, j = 0; j < 8; j++)
+				c = c & 1 ? (c >> 1) ^ 0xedb88320 : c >> 1;
+			crc32_table[i] = c;
+		}
+	}
+
+	crc = ~crc;
+	while (size--)
+		crc = crc32_table[(crc ^ *pos++) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+static void print_disk(const struct host_disk_stats *before)
+{
+	const struct host_disk_stats *now = disk.stats;
+
+	printf("                 disk: %llu reads (%llu MiB), %llu writes (%llu MiB), "
+	       "%llu erases (%llu MiB), %llu flushes, %llu unaligned\n",
+	       now->reads - before->reads, (now->read_bytes - before->read_bytes) >> 20,
+	       now->writes - before->writes, (now->write_bytes - before->write_bytes) >> 20,
+	       now->erases - before->erases, (now->erase_bytes - before->erase_bytes) >> 20,
+	       now->flushes - before->flushes, now->unaligned - before->unaligned);
+}
+
+/* Download DATA, run CMD and report the time CMD took for BYTES, by
+ * default the bytes written or erased on the disk */
+static int timed_flash(int fd, const char *name, const char *cmd,
+		       const void *data, unsigned size, unsigned long long bytes)
+{
+	char resp[RESPONSE_LENGTH + 1];
+	struct host_disk_stats before;
+	unsigned long long start;
+
+	if (data && client_download(fd, data, size, NULL))
+		return -1;
+
+	before = *disk.stats;
+	start = os_time_us();
+	if (client_command(fd, cmd, resp, NULL, 1))
+		return -1;
+
+	if (!bytes)
+		bytes = disk.stats->write_bytes - before.write_bytes +
+			disk.stats->erase_bytes - before.erase_bytes;
+	printf("%-16s ", name);
+	client_print_rate(bytes, os_time_us() - start);
+	print_disk(&before);
+	return 0;
+}
+
+static int bench_gpt(int fd)
+{
+	struct {
+		struct gpt_bin_header header;
+		struct gpt_bin_part parts[MAX_PARTS];
+	} gpt;
+	struct gpt_bin_part *part;
+	const char *pos = layout;
+	unsigned i;
+	char *end;
+
+	memset(&gpt, 0, sizeof(gpt));
+	gpt.header.magic = GPT_BIN_MAGIC;
+
+	while (*pos) {
+		if (gpt.header.npart == MAX_PARTS)
+			goto err;
+		part = &gpt.parts[gpt.header.npart++];
+		for (i = 0; *pos && *pos != ':'; pos++, i++) {
+			if (i == sizeof(part->label) / sizeof(*part->label) - 1)
+				goto err;
+			part->label[i] = *pos;
+		}
+		if (*pos++ != ':')
+			goto err;
+		part->length = strtol(pos, &end, 0);
+		if (end == pos || (*end && *end != ','))
+			goto err;
+		pos = *end ? end + 1 : end;
+		part->type = linux_data;
+		client_random(&part->uuid, sizeof(part->uuid), &random_state);
+	}
+
+	return timed_flash(fd, "flash:gpt", "flash:gpt", &gpt,
+			   sizeof(gpt.header) + gpt.header.npart * sizeof(*gpt.parts), 0);
+
+err:
+	fprintf(stderr, "Invalid layout %s\n", layout);
+	return -1;
+}
+
+static int bench_raw(int fd)
+{
+	unsigned size = image_mib << 20;
+	char cmd[64];
+	void *data;
+	int ret;
+
+	data = malloc(size);
+	if (!data)
+		return -1;
+
+	client_random(data, size, &random_state);
+	snprintf(cmd, sizeof(cmd), "flash:%s", flash_label);
+	ret = timed_flash(fd, "raw", cmd, data, size, size);
+	free(data);
+	return ret;
+}
+
+/* Every 4 MiB of output: 2 MiB of data, 1 MiB filled with zeros or
+ * with a pattern, 1 MiB left untouched.  The image ends with a CRC32
+ * chunk. */
+#define GROUP_BLOCKS (4 * 1024 * 1024 / SPARSE_BLOCK_SIZE)
+
+static char *add_chunk(char *pos, uint16_t type, uint32_t blocks, uint32_t data_size)
+{
+	struct chunk_header *chunk = (struct chunk_header *)pos;
+
+	chunk->chunk_type = type;
+	chunk->reserved1 = 0;
+	chunk->chunk_sz = blocks;
+	chunk->total_sz = sizeof(*chunk) + data_size;
+	return pos + sizeof(*chunk);
+}
+
+static int bench_sparse(int fd)
+{
+	static const uint32_t fills[] = { 0, 0x5a5aa5a5 };
+	unsigned groups = image_mib / 4, g, i, size;
+	unsigned fill_size = GROUP_BLOCKS / 4 * SPARSE_BLOCK_SIZE;
+	struct sparse_header *header;
+	uint32_t crc = 0, *filled;
+	char cmd[64], *image, *pos;
+	void *zeros;
+	int ret = -1;
+
+	if (!groups)
+		return 0;
+
+	size = sizeof(*header) + sizeof(struct chunk_header) + sizeof(crc) +
+		groups * (3 * sizeof(struct chunk_header) + 2 * 1024 * 1024 + sizeof(*fills));
+	image = malloc(size);
+	zeros = calloc(1, fill_size);
+	filled = malloc(fill_size);
+	if (!image || !zeros || !filled)
+		goto out;
+
+	header = (struct sparse_header *)image;
+	header->magic = SPARSE_HEADER_MAGIC;
+	header->major_version = 1;
+	header->minor_version = 0;
+	header->file_hdr_sz = sizeof(*header);
+	header->chunk_hdr_sz = sizeof(struct chunk_header);
+	header->blk_sz = SPARSE_BLOCK_SIZE;
+	header->total_blks = groups * GROUP_BLOCKS;
+	header->total_chunks = groups * 3 + 1;
+	header->image_checksum = 0;
+
+	/* The don't care chunks count as zeros in the checksum */
+	pos = image + sizeof(*header);
+	for (g = 0; g < groups; g++) {
+		pos = add_chunk(pos, CHUNK_TYPE_RAW, GROUP_BLOCKS / 2, 2 * 1024 * 1024);
+		client_random(pos, 2 * 1024 * 1024, &random_state);
+		crc = crc32(crc, pos, 2 * 1024 * 1024);
+		pos += 2 * 1024 * 1024;
+
+		pos = add_chunk(pos, CHUNK_TYPE_FILL, GROUP_BLOCKS / 4, sizeof(*fills));
+		memcpy(pos, &fills[g % 2], sizeof(*fills));
+		pos += sizeof(*fills);
+		for (i = 0; i < fill_size / sizeof(*filled); i++)
+			filled[i] = fills[g % 2];
+		crc = crc32(crc, filled, fill_size);
+
+		pos = add_chunk(pos, CHUNK_TYPE_DONT_CARE, GROUP_BLOCKS / 4, 0);
+		crc = crc32(crc, zeros, fill_size);
+	}
+	pos = add_chunk(pos, CHUNK_TYPE_CRC32, 0, sizeof(crc));
+	memcpy(pos, &crc, sizeof(crc));
+	pos += sizeof(crc);
+
+	snprintf(cmd, sizeof(cmd), "flash:%s", flash_label);
+	ret = timed_flash(fd, "sparse", cmd, image, pos - image,
+			  (unsigned long long)groups * GROUP_BLOCKS * SPARSE_BLOCK_SIZE);
+
+out:
+	free(image);
+	free(zeros);
+	free(filled);
+	return ret;
+}
+
+static int bench_erase(int fd)
+{
+	char cmd[64];
+
+	if (!*erase_label)
+		return 0;
+
+	snprintf(cmd, sizeof(cmd), "erase:%s", erase_label);
+	return timed_flash(fd, cmd, cmd, NULL, 0, 0);
+}
+
+static int client(int fd, void *arg)
+{
+	char **argv = arg, resp[RESPONSE_LENGTH + 1];
+	int argc;
+
+	for (argc = 0; argv[argc]; argc++)
+		;
+
+	if (bench_gpt(fd))
+		return -1;
+	if (image_mib && (bench_raw(fd) || bench_sparse(fd)))
+		return -1;
+	if (bench_erase(fd) || client_run(fd, argc, argv))
+		return -1;
+
+	if (client_command(fd, "oem storage-stats", resp, NULL, 1))
+		return -1;
+	return client_command(fd, "continue", resp, NULL, 1);
+}
+
+int main(int argc, char **argv)
+{
+	int fd, opt, ret;
+	pid_t pid;
+
+	while ((opt = getopt(argc, argv, "d:S:b:A:l:2eg:s:p:E:c:h")) != -1) {
+		switch (opt) {
+		case 'd':
+			disk.path = optarg;
+			break;
+		case 'S':
+			disk_mib = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			disk.block_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'A':
+			disk.io_align = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			disk.latency_us = strtoul(optarg, NULL, 0);
+			break;
+		case '2':
+			disk.block_io2 = 1;
+			break;
+		case 'e':
+			disk.erase_block = 1;
+			break;
+		case 'g':
+			layout = optarg;
+			break;
+		case 's':
+			image_mib = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			flash_label = optarg;
+			break;
+		case 'E':
+			erase_label = optarg;
+			break;
+		case 'c':
+			client_chunk = strtoul(optarg, NULL, 0) * 1024;
+			if (!client_chunk)
+				usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (!disk_mib && !disk.path)
+		disk_mib = 1024;
+	disk.size = (unsigned long long)disk_mib << 20;
+
+	/* Shared with the client, which reports the I/Os of each step */
+	disk.stats = mmap(NULL, sizeof(*disk.stats), PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (disk.stats == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+
+	pid = client_start(client, argv + optind, &fd);
+	if (pid < 0)
+		return 1;
+
+	ret = host_init() || host_disk_attach(&disk) || host_usb_attach(fd) ||
+		host_fastboot_run() || host_disk_sync();
+	close(fd);
+
+	if (client_wait(pid))
+		ret = 1;
+	return ret;
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2026, agent
+ * All rights reserved.
+ *
+ * Authors: agent <agent@local>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _HOST_H_
+#define _HOST_H_
+
+/* Entry points of the firmware side of the host harness, called by
+ * the benchmark programs.  Only plain C types here, see os.h.  The
+ * functions returning int return 0 on success, -1 on error. */
+
+/* Set up the system table and initialize the EFI library */
+int host_init(void);
+
+/* USB device mode stand-in.  The host writes [32 bits length][data]
+ * frames on FD, the end of a frame whose length is not a multiple of
+ * 512 acting as a short packet.  Each device to host transfer is
+ * sent as one such frame. */
+int host_usb_attach(int fd);
+
+/* Block device stand-in, the system disk.  It provides Block I/O and
+ * Disk I/O, and Block I/O 2 and Erase Block on request.  The I/Os are
+ * counted in STATS, which may be shared with another process. */
+struct host_disk_stats {
+	unsigned long long reads;
+	unsigned long long read_bytes;
+	unsigned long long writes;
+	unsigned long long write_bytes;
+	unsigned long long erases;
+	unsigned long long erase_bytes;
+	unsigned long long flushes;
+	unsigned long long unaligned;	/* Requests rejected for IoAlign */
+};
+
+struct host_disk_config {
+	const char *path;		/* Disk image, NULL for memory */
+	unsigned long long size;	/* In bytes, 0 for the size of PATH */
+	unsigned block_size;
+	unsigned io_align;
+	unsigned latency_us;		/* Time taken by each request */
+	int block_io2;
+	int erase_block;
+	struct host_disk_stats *stats;	/* NULL if not needed */
+};
+
+int host_disk_attach(const struct host_disk_config *config);
+int host_disk_sync(void);
+
+/* Run fastboot until the client asks to continue or to reboot */
+int host_fastboot_run(void);
+
+#endif	/* _HOST_H_ */
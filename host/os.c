@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2026, agent
+ * All rights reserved.
+ *
+ * Authors: agent <agent@local>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "os.h"
+
+void *os_malloc(unsigned long size)
+{
+	return malloc(size ? size : 1);
+}
+
+void os_free(void *ptr)
+{
+	free(ptr);
+}
+
+void os_copy(void *dst, const void *src, unsigned long len)
+{
+	memmove(dst, src, len);
+}
+
+void os_fill(void *dst, int value, unsigned long len)
+{
+	memset(dst, value, len);
+}
+
+void *os_map_anon(unsigned long long size)
+{
+	void *addr;
+
+	addr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	return addr == MAP_FAILED ? NULL : addr;
+}
+
+void os_unmap(void *addr, unsigned long long size)
+{
+	munmap(addr, size);
+}
+
+void *os_map_file(const char *path, unsigned long long *size)
+{
+	struct stat st;
+	void *addr;
+	int fd;
+
+	fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+		return NULL;
+
+	if (*size) {
+		if (ftruncate(fd, *size))
+			goto err;
+	} else {
+		if (fstat(fd, &st) || !st.st_size)
+			goto err;
+		*size = st.st_size;
+	}
+
+	addr = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	return addr == MAP_FAILED ? NULL : addr;
+
+err:
+	close(fd);
+	return NULL;
+}
+
+int os_sync(void *addr, unsigned long long size)
+{
+	return msync(addr, size, MS_SYNC) ? -1 : 0;
+}
+
+unsigned long long os_free_memory(void)
+{
+	long pages = sysconf(_SC_AVPHYS_PAGES);
+	long page_size = sysconf(_SC_PAGESIZE);
+
+	if (pages < 0 || page_size < 0)
+		return 0;
+	return (unsigned long long)pages * page_size;
+}
+
+unsigned long long os_time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void os_sleep_us(unsigned long long us)
+{
+	struct timespec ts = {
+		.tv_sec = us / 1000000,
+		.tv_nsec = (us % 1000000) * 1000
+	};
+
+	while (nanosleep(&ts, &ts) && errno == EINTR)
+		;
+}
+
+void os_localtime(unsigned *year, unsigned *month, unsigned *day,
+		  unsigned *hour, unsigned *minute, unsigned *second)
+{
+	time_t now = time(NULL);
+	struct tm tm;
+
+	localtime_r(&now, &tm);
+	*year = tm.tm_year + 1900;
+	*month = tm.tm_mon + 1;
+	*day = tm.tm_mday;
+	*hour = tm.tm_hour;
+	*minute = tm.tm_min;
+	*second = tm.tm_sec;
+}
+
+void os_print(const char *str, unsigned long len)
+{
+	os_write_full(STDOUT_FILENO, str, len);
+}
+
+void os_exit(int status)
+{
+	exit(status);
+}
+
+int os_poll_in(int fd, int timeout_ms)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	int ret;
+
+	do {
+		ret = poll(&pfd, 1, timeout_ms);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret <= 0)
+		return ret;
+	/* Data still queued before a hang-up is readable */
+	return pfd.revents & POLLIN ? 1 : -1;
+}
+
+int os_read_full(int fd, void *buf, unsigned long len)
+{
+	char *pos = buf;
+	ssize_t n;
+
+	while (len) {
+		n = read(fd, pos, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		pos += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+int os_write_full(int fd, const void *buf, unsigned long len)
+{
+	const char *pos = buf;
+	ssize_t n;
+
+	while (len) {
+		n = write(fd, pos, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		pos += n;
+		len -= n;
+	}
+
+	return 0;
+}
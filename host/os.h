@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2026, agent
+ * All rights reserved.
+ *
+ * Authors: agent <agent@local>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _HOST_OS_H_
+#define _HOST_OS_H_
+
+/* Linux services used by the host harness.  Only plain C types here:
+ * this header is shared by the files built against the firmware
+ * headers and by the ones built against the C library. */
+
+void *os_malloc(unsigned long size);
+void os_free(void *ptr);
+void os_copy(void *dst, const void *src, unsigned long len);
+void os_fill(void *dst, int value, unsigned long len);
+
+/* Page granular anonymous mappings, any sub-range can be unmapped */
+void *os_map_anon(unsigned long long size);
+void os_unmap(void *addr, unsigned long long size);
+
+/* Shared mapping of PATH.  The file is created or resized to *SIZE
+ * unless *SIZE is 0, in which case *SIZE is set to the file size. */
+void *os_map_file(const char *path, unsigned long long *size);
+int os_sync(void *addr, unsigned long long size);
+
+unsigned long long os_free_memory(void);
+unsigned long long os_time_us(void);
+void os_sleep_us(unsigned long long us);
+void os_localtime(unsigned *year, unsigned *month, unsigned *day,
+		  unsigned *hour, unsigned *minute, unsigned *second);
+
+void os_print(const char *str, unsigned long len);
+void os_exit(int status);
+
+/* Return 1 if FD is readable within TIMEOUT_MS, 0 on timeout, -1 on
+ * error or hang-up */
+int os_poll_in(int fd, int timeout_ms);
+int os_read_full(int fd, void *buf, unsigned long len);
+int os_write_full(int fd, const void *buf, unsigned long len);
+
+#endif	/* _HOST_OS_H_ */
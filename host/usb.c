@@ -0,0 +1,274 @@
+/*
+ * Copyright (c) 2026, agent
+ * All rights reserved.
+ *
+ * Authors: agent <agent@local>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <efi.h>
+#include <efilib.h>
+#include <lib.h>
+#include <fastboot.h>
+
+#include "UsbDeviceModeProtocol.h"
+#include "os.h"
+#include "host.h"
+
+/* EFI_USB_DEVICE_MODE_PROTOCOL over a socket.  Requests are queued
+ * by EpTxData() and EpRxData() and completed one at a time by Run(),
+ * so that the data callback never runs nested in another one.  The
+ * data of a transmission is sent right away as callers may pass a
+ * buffer on their stack. */
+
+#define USB_QUEUE_DEPTH 16
+#define USB_MAX_PACKET_SIZE 512
+
+struct usb_queue {
+	USB_DEVICE_IO_REQ requests[USB_QUEUE_DEPTH];
+	UINTN first;
+	UINTN count;
+};
+
+static int usb_fd = -1;
+static USB_DEVICE_OBJ *usb_dev;
+static BOOLEAN usb_configured;
+static struct usb_queue tx_queue, rx_queue;
+static UINT32 frame_left;	/* Bytes of the current host frame not read yet */
+static BOOLEAN short_packet;	/* The current host frame ends with a short packet */
+static UINT32 rx_done;		/* Bytes received by the first reception request */
+
+static EFI_STATUS queue_push(struct usb_queue *queue, USB_DEVICE_IO_REQ *req)
+{
+	if (queue->count == USB_QUEUE_DEPTH)
+		return EFI_OUT_OF_RESOURCES;
+
+	queue->requests[(queue->first + queue->count) % USB_QUEUE_DEPTH] = *req;
+	queue->count++;
+	return EFI_SUCCESS;
+}
+
+static void queue_pop(struct usb_queue *queue, USB_DEVICE_IO_REQ *req)
+{
+	*req = queue->requests[queue->first];
+	queue->first = (queue->first + 1) % USB_QUEUE_DEPTH;
+	queue->count--;
+}
+
+static EFI_STATUS complete(USB_DEVICE_IO_REQ *req, UINT8 dir, UINT32 length)
+{
+	EFI_USB_DEVICE_XFER_INFO info;
+
+	info.EndpointNum = req->EndpointInfo.EndpointDesc->EndpointAddress & 0xF;
+	info.EndpointDir = dir;
+	info.EndpointType = USB_ENDPOINT_BULK;
+	info.Length = length;
+	info.Buffer = req->IoInfo.Buffer;
+
+	return uefi_call_wrapper(usb_dev->DataCallback, 1, &info);
+}
+
+static EFI_STATUS complete_tx(void)
+{
+	USB_DEVICE_IO_REQ req;
+
+	queue_pop(&tx_queue, &req);
+	return complete(&req, USB_ENDPOINT_DIR_IN, req.IoInfo.Length);
+}
+
+/* Like on the bus, a reception request completes when it is full or
+ * on a short packet, that is at the end of a host frame whose length
+ * is not a multiple of the maximum packet size. */
+static EFI_STATUS complete_rx(UINT32 timeout_ms)
+{
+	USB_DEVICE_IO_REQ req;
+	UINT32 length;
+	int ready;
+
+	req = rx_queue.requests[rx_queue.first];
+	while (rx_done < req.IoInfo.Length) {
+		if (!frame_left) {
+			if (short_packet)
+				break;
+			ready = os_poll_in(usb_fd, timeout_ms);
+			if (!ready)
+				return EFI_TIMEOUT;
+			if (ready < 0 || os_read_full(usb_fd, &frame_left, sizeof(frame_left)))
+				return EFI_DEVICE_ERROR;
+			short_packet = !frame_left || frame_left % USB_MAX_PACKET_SIZE;
+			continue;
+		}
+
+		length = MIN(req.IoInfo.Length - rx_done, frame_left);
+		if (os_read_full(usb_fd, (UINT8 *)req.IoInfo.Buffer + rx_done, length))
+			return EFI_DEVICE_ERROR;
+		rx_done += length;
+		frame_left -= length;
+	}
+
+	if (!frame_left)
+		short_packet = FALSE;
+	length = rx_done;
+	rx_done = 0;
+	queue_pop(&rx_queue, &req);
+
+	return complete(&req, USB_ENDPOINT_DIR_OUT, length);
+}
+
+static EFIAPI EFI_STATUS usb_init_xdci(__attribute__((__unused__)) EFI_USB_DEVICE_MODE_PROTOCOL *this)
+{
+	return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS usb_connect(__attribute__((__unused__)) EFI_USB_DEVICE_MODE_PROTOCOL *this)
+{
+	usb_configured = FALSE;
+	return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS usb_disconnect(__attribute__((__unused__)) EFI_USB_DEVICE_MODE_PROTOCOL *this)
+{
+	tx_queue.count = 0;
+	rx_queue.count = 0;
+	rx_done = 0;
+	return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS usb_tx(__attribute__((__unused__)) EFI_USB_DEVICE_MODE_PROTOCOL *this,
+				USB_DEVICE_IO_REQ *req)
+{
+	UINT32 length = req->IoInfo.Length;
+
+	if (tx_queue.count == USB_QUEUE_DEPTH)
+		return EFI_OUT_OF_RESOURCES;
+
+	if (os_write_full(usb_fd, &length, sizeof(length)) ||
+	    os_write_full(usb_fd, req->IoInfo.Buffer, length))
+		return EFI_DEVICE_ERROR;
+
+	return queue_push(&tx_queue, req);
+}
+
+static EFIAPI EFI_STATUS usb_rx(__attribute__((__unused__)) EFI_USB_DEVICE_MODE_PROTOCOL *this,
+				USB_DEVICE_IO_REQ *req)
+{
+	return queue_push(&rx_queue, req);
+}
+
+static EFIAPI EFI_STATUS usb_bind(__attribute__((__unused__)) EFI_USB_DEVICE_MODE_PROTOCOL *this,
+				  USB_DEVICE_OBJ *dev)
+{
+	usb_dev = dev;
+	return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS usb_unbind(__attribute__((__unused__)) EFI_USB_DEVICE_MODE_PROTOCOL *this)
+{
+	usb_dev = NULL;
+	return EFI_SUCCESS;
+}
+
+/* The host selects the configuration on the first call */
+static EFIAPI EFI_STATUS usb_run(__attribute__((__unused__)) EFI_USB_DEVICE_MODE_PROTOCOL *this,
+				 UINT32 timeout_ms)
+{
+	if (!usb_dev)
+		return EFI_NOT_READY;
+
+	if (!usb_configured) {
+		usb_configured = TRUE;
+		return uefi_call_wrapper(usb_dev->ConfigCallback, 1,
+					 usb_dev->ConfigObjs[0].ConfigDesc->ConfigurationValue);
+	}
+
+	if (tx_queue.count)
+		return complete_tx();
+
+	if (rx_queue.count)
+		return complete_rx(timeout_ms);
+
+	uefi_call_wrapper(BS->Stall, 1, timeout_ms * 1000);
+	return EFI_TIMEOUT;
+}
+
+static EFIAPI EFI_STATUS usb_stop(__attribute__((__unused__)) EFI_USB_DEVICE_MODE_PROTOCOL *this)
+{
+	return EFI_SUCCESS;
+}
+
+/* fastboot_usb_start() frees the protocol structure when it is done */
+int host_usb_attach(int fd)
+{
+	EFI_USB_DEVICE_MODE_PROTOCOL *usb;
+	EFI_HANDLE handle = NULL;
+	EFI_STATUS ret;
+
+	usb = AllocateZeroPool(sizeof(*usb));
+	if (!usb)
+		return -1;
+
+	usb->InitXdci = usb_init_xdci;
+	usb->Connect = usb_connect;
+	usb->DisConnect = usb_disconnect;
+	usb->EpTxData = usb_tx;
+	usb->EpRxData = usb_rx;
+	usb->Bind = usb_bind;
+	usb->UnBind = usb_unbind;
+	usb->Run = usb_run;
+	usb->Stop = usb_stop;
+
+	ret = uefi_call_wrapper(BS->InstallProtocolInterface, 4, &handle,
+				&gEfiUsbDeviceModeProtocolGuid,
+				EFI_NATIVE_INTERFACE, usb);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to install the USB device mode protocol");
+		FreePool(usb);
+		return -1;
+	}
+
+	usb_fd = fd;
+	frame_left = 0;
+	short_packet = FALSE;
+	return 0;
+}
+
+int host_fastboot_run(void)
+{
+	void *bootimage, *efiimage;
+	enum boot_target target;
+	UINTN imagesize;
+	EFI_STATUS ret;
+
+	ret = fastboot_start(&bootimage, &efiimage, &imagesize, &target);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Fastboot failed");
+		return -1;
+	}
+
+	debug(L"Fastboot done, target %d", target);
+	return 0;
+}
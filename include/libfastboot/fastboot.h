@@ -43,10 +43,20 @@ extern const EFI_GUID fastboot_guid;
 
 typedef void (*fastboot_handle) (INTN argc, CHAR8 **argv);
 
+/* A variable provider publishes, with fastboot_publish(), the
+ * variables starting with the prefix it is registered for: NAME only,
+ * or all of them when NAME is NULL.  It is only called when a getvar
+ * asks for one of them and the result is kept until it is
+ * invalidated. */
+typedef void (*fastboot_var_provider) (const char *name);
+
 void fastboot_publish(const char *name, const char *value);
+void fastboot_register_provider(const char *prefix,
+				fastboot_var_provider provide);
 void fastboot_okay(const char *fmt, ...);
 void fastboot_fail(const char *fmt, ...);
 void fastboot_info(const char *fmt, ...);
+void fastboot_stage(VOID *data, UINTN size);
 void fastboot_register(const char *prefix, fastboot_handle handle,
 		       BOOLEAN restricted);
 void fastboot_oem_register(const char *prefix, fastboot_handle handle,
@@ -144,6 +144,10 @@ EFI_STATUS android_image_load_partition(
                 IN const EFI_GUID *guid,
                 OUT VOID **bootimage_p);
 
+/* Free a boot image returned by android_image_load_partition(), the
+ * images loaded from a file are freed with FreePool() */
+VOID android_image_free_partition(IN VOID *bootimage);
+
 EFI_STATUS android_image_load_file(
                 IN EFI_HANDLE device,
                 IN CHAR16 *loader,
@@ -514,6 +514,16 @@ static EFI_STATUS load_boot_image(
 }
 
 
+/* Free a boot image returned by load_boot_image() */
+static VOID free_boot_image(IN enum boot_target boot_target, IN VOID *bootimage)
+{
+        if (boot_target == ESP_BOOTIMAGE)
+                FreePool(bootimage);
+        else
+                android_image_free_partition(bootimage);
+}
+
+
 /* Chainload another EFI application on the ESP with the specified path,
  * optionally deleting the file before entering */
 static EFI_STATUS enter_efi_binary(CHAR16 *path, BOOLEAN delete)
@@ -640,6 +650,9 @@ static VOID enter_fastboot_mode(UINT8 boot_state, VOID *keystore,
 
         start_image:
                 load_image(bootimage, boot_state);
+                /* A "fastboot boot" image belongs to the fastboot code */
+                if (target != UNKNOWN_TARGET)
+                        free_boot_image(target, bootimage);
         }
 
         /* Allow plenty of time for the error to be visible before the
@@ -734,8 +747,9 @@ fallback:
                 /* Fall back to loading Recovery Console so they
                  * can sideload an OTA to fix their device */
                 debug(L"fall back to recovery console");
+                free_boot_image(boot_target, bootimage);
+                bootimage = NULL;
                 boot_target = RECOVERY;
-                FreePool(bootimage);
                 goto fallback;
         }
 
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2026, agent
+ * All rights reserved.
+ *
+ * Authors: agent <agent@local>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <efi.h>
+#include <efilib.h>
+
+#include "chacha20.h"
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QUARTERROUND(a, b, c, d)				\
+	do {							\
+		a += b; d ^= a; d = ROTL32(d, 16);		\
+		c += d; b ^= c; b = ROTL32(b, 12);		\
+		a += b; d ^= a; d = ROTL32(d, 8);		\
+		c += d; b ^= c; b = ROTL32(b, 7);		\
+	} while (0)
+
+static UINT32 load32(const UINT8 *p)
+{
+	return (UINT32)p[0] | ((UINT32)p[1] << 8) |
+		((UINT32)p[2] << 16) | ((UINT32)p[3] << 24);
+}
+
+void chacha20_init(struct chacha20 *ctx, const UINT8 *key, const UINT8 *nonce,
+		   UINT64 counter)
+{
+	UINTN i;
+
+	/* "expand 32-byte k" */
+	ctx->state[0] = 0x61707865;
+	ctx->state[1] = 0x3320646e;
+	ctx->state[2] = 0x79622d32;
+	ctx->state[3] = 0x6b206574;
+	for (i = 0; i < CHACHA20_KEY_SIZE / 4; i++)
+		ctx->state[4 + i] = load32(key + 4 * i);
+	ctx->state[12] = (UINT32)counter;
+	ctx->state[13] = (UINT32)(counter >> 32);
+	ctx->state[14] = load32(nonce);
+	ctx->state[15] = load32(nonce + 4);
+}
+
+/* x86 is little endian, the state words are stored as they are */
+void chacha20_keystream(struct chacha20 *ctx, VOID *out, UINTN size)
+{
+	UINT32 x[16], *o = out;
+	UINTN i;
+
+	for (; size >= CHACHA20_BLOCK_SIZE; size -= CHACHA20_BLOCK_SIZE) {
+		for (i = 0; i < 16; i++)
+			x[i] = ctx->state[i];
+
+		for (i = 0; i < 10; i++) {
+			QUARTERROUND(x[0], x[4], x[8], x[12]);
+			QUARTERROUND(x[1], x[5], x[9], x[13]);
+			QUARTERROUND(x[2], x[6], x[10], x[14]);
+			QUARTERROUND(x[3], x[7], x[11], x[15]);
+			QUARTERROUND(x[0], x[5], x[10], x[15]);
+			QUARTERROUND(x[1], x[6], x[11], x[12]);
+			QUARTERROUND(x[2], x[7], x[8], x[13]);
+			QUARTERROUND(x[3], x[4], x[9], x[14]);
+		}
+
+		for (i = 0; i < 16; i++)
+			o[i] = x[i] + ctx->state[i];
+		o += 16;
+
+		if (!++ctx->state[12])
+			ctx->state[13]++;
+	}
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2026, agent
+ * All rights reserved.
+ *
+ * Authors: agent <agent@local>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _CHACHA20_H_
+#define _CHACHA20_H_
+
+#include <efi.h>
+
+/* ChaCha20 keystream generator, with the original 64-bit block counter
+ * and 64-bit nonce so that a single key covers any disk size.  It is
+ * used to produce random data at disk speed, not for encryption. */
+#define CHACHA20_KEY_SIZE 32
+#define CHACHA20_NONCE_SIZE 8
+#define CHACHA20_BLOCK_SIZE 64
+
+struct chacha20 {
+	UINT32 state[16];
+};
+
+void chacha20_init(struct chacha20 *ctx, const UINT8 *key, const UINT8 *nonce,
+		   UINT64 counter);
+
+/* SIZE must be a multiple of CHACHA20_BLOCK_SIZE and OUT 32-bit
+ * aligned */
+void chacha20_keystream(struct chacha20 *ctx, VOID *out, UINTN size);
+
+#endif	/* _CHACHA20_H_ */
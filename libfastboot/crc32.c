@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2026, agent
+ * All rights reserved.
+ *
+ * Authors: agent <agent@local>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <efi.h>
+#include <efilib.h>
+
+#include "crc32.h"
+
+#define CRC32_POLY 0xEDB88320
+
+/* Slice-by-8: eight tables let the main loop consume 8 bytes per
+ * iteration.  They are built on first use. */
+static UINT32 crc32_table[8][256];
+static BOOLEAN crc32_table_ready;
+
+static void crc32_init_table(void)
+{
+	UINT32 c;
+	UINTN i, k;
+
+	for (i = 0; i < 256; i++) {
+		c = i;
+		for (k = 0; k < 8; k++)
+			c = c & 1 ? (c >> 1) ^ CRC32_POLY : c >> 1;
+		crc32_table[0][i] = c;
+	}
+
+	for (i = 0; i < 256; i++)
+		for (k = 1; k < 8; k++)
+			crc32_table[k][i] = (crc32_table[k - 1][i] >> 8)
+				^ crc32_table[0][crc32_table[k - 1][i] & 0xFF];
+
+	crc32_table_ready = TRUE;
+}
+
+UINT32 crc32_update(UINT32 crc, const VOID *data, UINTN len)
+{
+	const UINT8 *p = data;
+	UINT32 lo, hi;
+
+	if (!crc32_table_ready)
+		crc32_init_table();
+
+	crc = ~crc;
+
+	for (; len && ((UINTN)p & 7); len--)
+		crc = crc32_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+
+	for (; len >= 8; len -= 8, p += 8) {
+		lo = *(const UINT32 *)p ^ crc;
+		hi = *(const UINT32 *)(p + 4);
+		crc = crc32_table[7][lo & 0xFF] ^
+			crc32_table[6][(lo >> 8) & 0xFF] ^
+			crc32_table[5][(lo >> 16) & 0xFF] ^
+			crc32_table[4][lo >> 24] ^
+			crc32_table[3][hi & 0xFF] ^
+			crc32_table[2][(hi >> 8) & 0xFF] ^
+			crc32_table[1][(hi >> 16) & 0xFF] ^
+			crc32_table[0][hi >> 24];
+	}
+
+	for (; len; len--)
+		crc = crc32_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+
+	return ~crc;
+}
+
+/* Extending a CRC with zeros is a linear operation on the CRC
+ * register.  It is applied with GF(2) matrices, squared to double
+ * the number of zeros, so that LEN zero bytes cost O(log(LEN)). */
+static UINT32 gf2_matrix_times(const UINT32 *mat, UINT32 vec)
+{
+	UINT32 sum = 0;
+
+	for (; vec; vec >>= 1, mat++)
+		if (vec & 1)
+			sum ^= *mat;
+
+	return sum;
+}
+
+static void gf2_matrix_square(UINT32 *square, const UINT32 *mat)
+{
+	UINTN n;
+
+	for (n = 0; n < 32; n++)
+		square[n] = gf2_matrix_times(mat, mat[n]);
+}
+
+UINT32 crc32_zeros(UINT32 crc, UINT64 len)
+{
+	UINT32 even[32], odd[32];
+	UINT32 reg = ~crc;
+	UINTN n;
+
+	if (!len)
+		return crc;
+
+	/* Operator for one zero bit */
+	odd[0] = CRC32_POLY;
+	for (n = 1; n < 32; n++)
+		odd[n] = 1 << (n - 1);
+
+	/* Two then four zero bits */
+	gf2_matrix_square(even, odd);
+	gf2_matrix_square(odd, even);
+
+	/* Apply one byte, two bytes, four bytes, ... of zeros for each
+	 * bit set in LEN */
+	for (;;) {
+		gf2_matrix_square(even, odd);
+		if (len & 1)
+			reg = gf2_matrix_times(even, reg);
+		len >>= 1;
+		if (!len)
+			break;
+
+		gf2_matrix_square(odd, even);
+		if (len & 1)
+			reg = gf2_matrix_times(odd, reg);
+		len >>= 1;
+		if (!len)
+			break;
+	}
+
+	return ~reg;
+}
@@ -34,6 +34,7 @@
 
 #include <efi.h>
 #include <efilib.h>
+#include <openssl/sha.h>
 #include <lib.h>
 #include <vars.h>
 #include <string.h>
@@ -44,6 +45,8 @@
 #include "fastboot.h"
 #include "fastboot_usb.h"
 #include "flash.h"
+#include "storage.h"
+#include "sglist.h"
 #include "fastboot_oem.h"
 #include "fastboot_ui.h"
 #include "smbios.h"
@@ -51,21 +54,48 @@
 #include "intel_variables.h"
 
 #define MAGIC_LENGTH 64
-#define MAX_DOWNLOAD_SIZE 512*1024*1024
+/* Commands and replies are MAGIC_LENGTH bytes at most, as hosts
+ * expect.  Only the flash commands may be longer, to carry a SHA-256
+ * in hexadecimal: "flash:<label>:<sha256>[:<option>...]".  Commands
+ * are received in a request of a USB packet. */
+#define MAX_FLASH_COMMAND_LENGTH 256
+#define COMMAND_BUFFER_LENGTH 512
+/* The download size is sent back as 8 hexadecimal digits */
+#define MAX_DOWNLOAD_SIZE 0xFFFFF000
+/* Free memory left to the rest of the loader when computing the
+ * maximum download size */
+#define DOWNLOAD_RESERVED_MEMORY (128 * MiB)
 #define MAX_VARIABLE_LENGTH 128
 
 struct fastboot_cmd {
-	struct fastboot_cmd *next;
 	const CHAR8 *prefix;
-	unsigned prefix_len;
 	BOOLEAN restricted;
 	fastboot_handle handle;
 };
 
+/* Commands are stored in a trie keyed on their prefix, one node per
+ * character.  A lookup walks the received command once and returns
+ * the longest registered prefix, whatever the registration order. */
+struct cmd_node {
+	CHAR8 c;
+	struct cmd_node *child;
+	struct cmd_node *sibling;
+	struct fastboot_cmd *cmd;
+};
+
 struct fastboot_var {
 	struct fastboot_var *next;
-	char name[MAX_VARIABLE_LENGTH];
-	char value[MAX_VARIABLE_LENGTH];
+	char *name;
+	char *value;
+};
+
+/* Variables computed on demand, see fastboot_register_provider() */
+struct fastboot_provider {
+	struct fastboot_provider *next;
+	const char *prefix;
+	UINTN prefix_len;
+	fastboot_var_provider provide;
+	BOOLEAN complete;	/* All its variables are published */
 };
 
 enum fastboot_states {
@@ -74,53 +104,156 @@ enum fastboot_states {
 	STATE_COMPLETE,
 	STATE_START_DOWNLOAD,
 	STATE_DOWNLOAD,
+	STATE_DOWNLOAD_ABORT,
+	STATE_START_UPLOAD,
+	STATE_UPLOAD,
 	STATE_GETVAR,
 	STATE_ERROR,
 };
 
 EFI_GUID guid_linux_data = {0x0fc63daf, 0x8483, 0x4772, {0x8e, 0x79, 0x3d, 0x69, 0xd8, 0x47, 0x7d, 0xe4}};
 
-static struct fastboot_cmd *cmdlist;
-static struct fastboot_cmd *oem_cmdlist;
-static char command_buffer[MAGIC_LENGTH];
+static struct cmd_node cmdtree;
+static struct cmd_node oem_cmdtree;
+static char command_buffer[COMMAND_BUFFER_LENGTH + 1];
 static struct fastboot_var *varlist;
+static struct fastboot_provider *providerlist;
 static enum fastboot_states fastboot_state = STATE_OFFLINE;
-/* Download buffer and size, for download and flash commands */
-static void *dlbuffer;
-static unsigned dlsize;
+/* INFO replies sent but not transmitted yet.  They precede the final
+ * reply, whose transmission alone queues the next command read. */
+static UINTN infos_pending;
+/* Download buffer, for download and flash commands */
+static struct sglist dlbuffer;
+static UINT64 max_download_size;
+
+/* Download progress: bytes expected, queued for reception and
+ * already received.  The length of each queued request is kept to
+ * detect short transfers, and dl_entry/dl_entry_offset locate the
+ * next request in dlbuffer. */
+#define DOWNLOAD_QUEUE_DEPTH 4
+static unsigned dl_expected;
+static unsigned dl_queued;
+static unsigned dl_received;
+static unsigned dl_requests[DOWNLOAD_QUEUE_DEPTH];
+static unsigned dl_pending;
+static unsigned dl_first;
+static UINTN dl_entry;
+static UINTN dl_entry_offset;
+static UINT64 dl_start_ms;
+/* A failed download waits for its queued requests to complete before
+ * the next command is read, see download_abort() */
+static BOOLEAN dl_abort_acked;
+
+/* Protocol statistics, reported by "oem protocol-stats".  The
+ * latency of a command runs from its reception to its first response
+ * and "getvar all" is timed up to its final OKAY. */
+static struct protocol_stats {
+	UINT64 cmd_start_us;
+	BOOLEAN cmd_pending;
+	UINT32 commands;
+	UINT64 cmd_total_us;
+	UINT64 cmd_max_us;
+	UINT64 getvar_all_start_us;
+	UINT64 getvar_all_us;
+	UINT32 downloads;
+	UINT64 download_bytes;
+	UINT64 download_ms;
+} stats;
+
+/* SHA-256 of the downloaded data, updated as each transfer lands */
+static SHA256_CTX dl_sha256_ctx;
+static CHAR8 dl_sha256[SHA256_DIGEST_LENGTH * 2 + 1];
+
+/* Streaming flash: when armed with "oem stream-flash <label>", the
+ * next download is written to the partition while it is received,
+ * through a ring of bounded buffers instead of dlbuffer.  The
+ * following "flash:<label>" only reports the outcome. */
+#define STREAM_BUFFERS DOWNLOAD_QUEUE_DEPTH
+static CHAR16 *stream_label;
+static void *stream_buffers[STREAM_BUFFERS];
+static EFI_STATUS stream_status;
+static BOOLEAN stream_done;
+
+static struct cmd_node *cmd_node_child(struct cmd_node *node, CHAR8 c)
+{
+	for (node = node->child; node; node = node->sibling)
+		if (node->c == c)
+			return node;
 
-static void cmd_register(struct fastboot_cmd **list, const char *prefix,
+	return NULL;
+}
+
+static void cmd_register(struct cmd_node *tree, const char *prefix,
 			 fastboot_handle handle, BOOLEAN restricted)
 {
 	struct fastboot_cmd *cmd;
+	struct cmd_node *node, *child;
+	const CHAR8 *c;
+
 	cmd = AllocatePool(sizeof(*cmd));
 	if (!cmd) {
 		error(L"Failed to allocate fastboot command %a", prefix);
 		return;
 	}
 	cmd->prefix = (CHAR8 *)prefix;
-	cmd->prefix_len = strlen((const CHAR8 *)prefix);
 	cmd->restricted = restricted;
 	cmd->handle = handle;
-	cmd->next = *list;
-	*list = cmd;
+
+	for (node = tree, c = cmd->prefix; *c; c++, node = child) {
+		child = cmd_node_child(node, *c);
+		if (child)
+			continue;
+
+		child = AllocateZeroPool(sizeof(*child));
+		if (!child) {
+			error(L"Failed to allocate fastboot command %a", prefix);
+			FreePool(cmd);
+			return;
+		}
+		child->c = *c;
+		child->sibling = node->child;
+		node->child = child;
+	}
+
+	/* A command registered again replaces the previous one */
+	if (node->cmd)
+		FreePool(node->cmd);
+	node->cmd = cmd;
 }
 
 void fastboot_register(const char *prefix,
 		       fastboot_handle handle,
 		       BOOLEAN restricted)
 {
-	cmd_register(&cmdlist, prefix, handle, restricted);
+	cmd_register(&cmdtree, prefix, handle, restricted);
 }
 
 void fastboot_oem_register(const char *prefix,
 			   fastboot_handle handle,
 			   BOOLEAN restricted)
 {
-	cmd_register(&oem_cmdlist, prefix, handle, restricted);
+	cmd_register(&oem_cmdtree, prefix, handle, restricted);
 }
 
-struct fastboot_var *fastboot_getvar(const char *name)
+static char *var_strdup(const char *str)
+{
+	UINTN len = strlena((CHAR8 *)str) + 1;
+	char *dup;
+
+	dup = AllocatePool(len);
+	if (dup)
+		CopyMem(dup, str, len);
+	return dup;
+}
+
+static void free_var(struct fastboot_var *var)
+{
+	FreePool(var->name);
+	FreePool(var->value);
+	FreePool(var);
+}
+
+static struct fastboot_var *lookup_var(const char *name)
 {
 	struct fastboot_var *var;
 
@@ -131,56 +264,130 @@ struct fastboot_var *fastboot_getvar(const char *name)
 	return NULL;
 }
 
-/*
- * remove all fastboot variable which starts with partition-
- */
-#define MATCH_PART "partition-"
-static void clean_partition_var(void)
+static struct fastboot_provider *get_provider(const char *name)
+{
+	struct fastboot_provider *provider;
+
+	for (provider = providerlist; provider; provider = provider->next)
+		if (!memcmp(provider->prefix, name, provider->prefix_len))
+			return provider;
+
+	return NULL;
+}
+
+struct fastboot_var *fastboot_getvar(const char *name)
 {
+	struct fastboot_provider *provider;
 	struct fastboot_var *var;
-	struct fastboot_var *old_varlist;
-	struct fastboot_var *next;
 
-	old_varlist = varlist;
-	varlist = NULL;
+	var = lookup_var(name);
+	if (var)
+		return var;
 
-	for (var = old_varlist; var; var = next) {
-		next = var->next;
-		if (!memcmp(MATCH_PART, var->name, strlena((CHAR8 *) MATCH_PART))) {
-			FreePool(var);
-		} else {
-			var->next = varlist;
-			varlist = var;
+	provider = get_provider(name);
+	if (!provider || provider->complete)
+		return NULL;
+
+	provider->provide(name);
+	return lookup_var(name);
+}
+
+/* Have all the providers publish all their variables, for "getvar
+ * all" */
+static void complete_providers(void)
+{
+	struct fastboot_provider *provider;
+
+	for (provider = providerlist; provider; provider = provider->next) {
+		if (provider->complete)
+			continue;
+		provider->provide(NULL);
+		provider->complete = TRUE;
+	}
+}
+
+void fastboot_register_provider(const char *prefix,
+				fastboot_var_provider provide)
+{
+	struct fastboot_provider *provider;
+
+	for (provider = providerlist; provider; provider = provider->next)
+		if (!strcmp((CHAR8 *)prefix, (CHAR8 *)provider->prefix))
+			break;
+
+	if (!provider) {
+		provider = AllocateZeroPool(sizeof(*provider));
+		if (!provider) {
+			error(L"Failed to allocate provider %a", prefix);
+			return;
 		}
+		provider->next = providerlist;
+		providerlist = provider;
 	}
+
+	provider->prefix = prefix;
+	provider->prefix_len = strlena((CHAR8 *)prefix);
+	provider->provide = provide;
+	provider->complete = FALSE;
+}
+
+/* Drop the cached variables of the provider of PREFIX, they are
+ * computed again on the next request. */
+static void invalidate_provider(const char *prefix)
+{
+	struct fastboot_provider *provider;
+	struct fastboot_var *var, **prev;
+
+	provider = get_provider(prefix);
+	if (!provider)
+		return;
+
+	for (prev = &varlist; (var = *prev); ) {
+		if (!memcmp(provider->prefix, var->name, provider->prefix_len)) {
+			*prev = var->next;
+			free_var(var);
+		} else
+			prev = &var->next;
+	}
+
+	provider->complete = FALSE;
 }
 
 void fastboot_publish(const char *name, const char *value)
 {
 	struct fastboot_var *var;
-	UINTN namelen = strlena((CHAR8 *) name) + 1;
-	UINTN valuelen = strlena((CHAR8 *) value) + 1;
+	char *dup;
 
-	if (namelen > sizeof(var->name) ||
-	    valuelen > sizeof(var->value)) {
-		error(L"name or value too long");
+	dup = var_strdup(value);
+	if (!dup) {
+		error(L"Failed to allocate variable %a", name);
 		return;
 	}
-	var = fastboot_getvar(name);
-	if (!var) {
-		var = AllocateZeroPool(sizeof(*var));
-		if (!var) {
-			error(L"Failed to allocate variable %a", name);
-			return;
-		}
-		var->next = varlist;
-		varlist = var;
+
+	var = lookup_var(name);
+	if (var) {
+		FreePool(var->value);
+		var->value = dup;
+		return;
+	}
+
+	var = AllocateZeroPool(sizeof(*var));
+	if (!var || !(var->name = var_strdup(name))) {
+		error(L"Failed to allocate variable %a", name);
+		if (var)
+			FreePool(var);
+		FreePool(dup);
+		return;
 	}
-	CopyMem(var->name, name, namelen);
-	CopyMem(var->value, value, valuelen);
+	var->value = dup;
+	var->next = varlist;
+	varlist = var;
 }
 
-static void publish_partsize(void)
+/* "partition-size:<label>" and "partition-type:<label>", computed
+ * from the GPT on demand.  They are dropped when the GPT changes. */
+#define MATCH_PART "partition-"
+static void publish_partition_vars(const char *name)
 {
 	struct gpt_partition_interface *gparti;
 	UINTN part_count;
@@ -203,11 +410,14 @@ static void publish_partsize(void)
 				       (CHAR8 *)"0x%lX", size)))
 			continue;
 
-		fastboot_publish(fastboot_var, partsize);
+		if (!name || !strcmp((CHAR8 *)name, (CHAR8 *)fastboot_var))
+			fastboot_publish(fastboot_var, partsize);
 
 		if (EFI_ERROR(snprintf((CHAR8 *)fastboot_var, sizeof(fastboot_var),
 				       (CHAR8 *)"partition-type:%s", gparti[i].part.name)))
 			continue;
+		if (name && strcmp((CHAR8 *)name, (CHAR8 *)fastboot_var))
+			continue;
 
 		if (!CompareGuid(&gparti[i].part.type, &guid_linux_data))
 			fastboot_publish(fastboot_var, "ext4");
@@ -218,6 +428,76 @@ static void publish_partsize(void)
 	}
 }
 
+/* "storage-*", the eMMC geometry.  All of them are published at
+ * once, they come from the same register. */
+#define MATCH_STORAGE "storage-"
+static void publish_storage_var(const char *name, const char *fmt, UINT64 value)
+{
+	char buf[MAX_VARIABLE_LENGTH];
+
+	if (!EFI_ERROR(snprintf((CHAR8 *)buf, sizeof(buf), (CHAR8 *)fmt, value)))
+		fastboot_publish(name, buf);
+}
+
+static void publish_storage_vars(__attribute__((__unused__)) const char *name)
+{
+	const struct storage_geometry *geo;
+
+	if (EFI_ERROR(storage_get_geometry(&geo)))
+		return;
+
+	publish_storage_var("storage-size", "0x%lX", geo->sectors * 512);
+	publish_storage_var("storage-ext-csd-rev", "%ld", geo->ext_csd_rev);
+	publish_storage_var("storage-erase-group-size", "0x%lX", geo->erase_grp_size * 512);
+	publish_storage_var("storage-erase-timeout", "%ld", geo->erase_timeout);
+	publish_storage_var("storage-wp-group-size", "0x%lX", geo->wp_grp_size * 512);
+	publish_storage_var("storage-cache-size", "0x%lX", geo->cache_size);
+	fastboot_publish("storage-secure-erase", geo->has_secure_erase ? "yes" : "no");
+	fastboot_publish("storage-trim", geo->has_trim ? "yes" : "no");
+	fastboot_publish("storage-discard", geo->has_discard ? "yes" : "no");
+	publish_storage_var("storage-erased-mem-cont", "%ld", geo->erased_mem_cont);
+}
+
+/* "flash-progress" is "<label>:<offset>" while the flash of <label>
+ * can be resumed from <offset> of the image, empty otherwise */
+#define FLASH_PROGRESS "flash-progress"
+static void publish_flash_progress(__attribute__((__unused__)) const char *name)
+{
+	char progress[MAX_VARIABLE_LENGTH];
+	CHAR16 *label;
+	UINT64 offset;
+
+	if (EFI_ERROR(flash_get_progress(&label, &offset))) {
+		fastboot_publish(FLASH_PROGRESS, "");
+		return;
+	}
+
+	if (!EFI_ERROR(snprintf((CHAR8 *)progress, sizeof(progress),
+				(CHAR8 *)"%s:0x%lX", label, offset)))
+		fastboot_publish(FLASH_PROGRESS, progress);
+	FreePool(label);
+}
+
+static void stats_command_start(void)
+{
+	stats.cmd_start_us = uefi_get_us();
+	stats.cmd_pending = TRUE;
+}
+
+static void stats_command_response(void)
+{
+	UINT64 elapsed;
+
+	if (!stats.cmd_pending)
+		return;
+
+	elapsed = uefi_get_us() - stats.cmd_start_us;
+	stats.cmd_pending = FALSE;
+	stats.commands++;
+	stats.cmd_total_us += elapsed;
+	stats.cmd_max_us = MAX(stats.cmd_max_us, elapsed);
+}
+
 static void fastboot_ack(const char *code, const char *format, va_list ap)
 {
 	CHAR8 response[MAGIC_LENGTH];
@@ -237,6 +517,7 @@ static void fastboot_ack(const char *code, const char *format, va_list ap)
 		reason[i - 1] = '\0';
 	snprintf(response, MAGIC_LENGTH, (CHAR8 *)"%a%a", code, reason);
 	debug(L"SENT %a %a", code, reason);
+	stats_command_response();
 	if (usb_write(response, MAGIC_LENGTH) < 0)
 		fastboot_state = STATE_ERROR;
 }
@@ -245,6 +526,7 @@ void fastboot_info(const char *fmt, ...)
 {
 	va_list ap;
 
+	infos_pending++;
 	va_start(ap, fmt);
 	fastboot_ack("INFO", fmt, ap);
 	va_end(ap);
@@ -272,27 +554,170 @@ void fastboot_okay(const char *fmt, ...)
 	fastboot_state = STATE_COMPLETE;
 }
 
+static void stream_reset(void)
+{
+	if (stream_label) {
+		FreePool(stream_label);
+		stream_label = NULL;
+	}
+	stream_done = FALSE;
+}
+
+/* Options of the flash:<label>[:<option>...] command */
+struct flash_args {
+	CHAR8 *label;
+	CHAR8 *sha256;		/* Expected SHA-256 of the downloaded data */
+	BOOLEAN discard;	/* Erase the ranges the image does not cover */
+	BOOLEAN diff;		/* Only write the blocks which differ */
+	BOOLEAN verify;		/* Read back and check the written data */
+};
+
+static BOOLEAN is_sha256_str(CHAR8 *str)
+{
+	UINTN i;
+
+	for (i = 0; i < SHA256_DIGEST_LENGTH * 2; i++)
+		if (!((str[i] >= '0' && str[i] <= '9') ||
+		      (str[i] >= 'a' && str[i] <= 'f') ||
+		      (str[i] >= 'A' && str[i] <= 'F')))
+			return FALSE;
+
+	return str[i] == '\0' || str[i] == ':';
+}
+
+static BOOLEAN is_flash_option(CHAR8 *opt, const char *name)
+{
+	UINTN len = strlen((CHAR8 *)name);
+
+	return !strncmp(opt, (CHAR8 *)name, len) && (opt[len] == '\0' || opt[len] == ':');
+}
+
+static EFI_STATUS parse_flash_args(CHAR8 *arg, struct flash_args *args)
+{
+	CHAR8 *opt;
+
+	ZeroMem(args, sizeof(*args));
+	args->label = arg;
+
+	for (opt = arg; *opt; opt++) {
+		if (*opt != ':')
+			continue;
+		*opt = '\0';
+		if (is_sha256_str(opt + 1))
+			args->sha256 = opt + 1;
+		else if (is_flash_option(opt + 1, "discard"))
+			args->discard = TRUE;
+		else if (is_flash_option(opt + 1, "diff"))
+			args->diff = TRUE;
+		else if (is_flash_option(opt + 1, "verify"))
+			args->verify = TRUE;
+		else if (opt[1] != '\0' && opt[1] != ':') {
+			error(L"Unknown flash option %a", opt + 1);
+			return EFI_INVALID_PARAMETER;
+		}
+	}
+
+	return EFI_SUCCESS;
+}
+
+static BOOLEAN download_sha256_matches(CHAR8 *expected)
+{
+	UINTN i;
+	CHAR8 c;
+
+	if (!dl_sha256[0])
+		return FALSE;
+
+	for (i = 0; i < SHA256_DIGEST_LENGTH * 2; i++) {
+		c = expected[i];
+		if (c >= 'A' && c <= 'F')
+			c += 'a' - 'A';
+		if (c != dl_sha256[i])
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* The discard mode can be made the default with "oem setvar
+ * flash-discard 1" */
+#define FLASH_DISCARD_VAR L"flash-discard"
+#define FLASH_VERIFY_VAR L"flash-verify"
+
+/* Flash options enabled by default when VAR is "1" */
+static BOOLEAN flash_default(CHAR16 *var)
+{
+	CHAR16 *val;
+	BOOLEAN enabled;
+
+	val = get_efi_variable_str8(&fastboot_guid, var);
+	if (!val)
+		return FALSE;
+
+	enabled = !StrCmp(val, L"1");
+	FreePool(val);
+	return enabled;
+}
+
 static void cmd_flash(INTN argc, CHAR8 **argv)
 {
 	EFI_STATUS ret;
 	CHAR16 *label;
+	struct flash_args args;
 
 	if (argc != 2) {
 		fastboot_fail("Invalid parameter");
 		return;
 	}
 
+	ret = parse_flash_args(argv[1], &args);
+	if (EFI_ERROR(ret)) {
+		fastboot_fail("Invalid parameter");
+		return;
+	}
 
-	label = stra_to_str((CHAR8*)argv[1]);
+	label = stra_to_str(args.label);
 	if (!label) {
-		error(L"Failed to get label %a", argv[1]);
+		error(L"Failed to get label %a", args.label);
 		fastboot_fail("Allocation error");
 		return;
 	}
+
+	if (stream_label) {
+		if (!stream_done)
+			fastboot_fail("Nothing streamed to %s yet", stream_label);
+		else if (StrCmp(label, stream_label))
+			fastboot_fail("Data was streamed to %s", stream_label);
+		else if (EFI_ERROR(stream_status))
+			fastboot_fail("Flash failure: %r", stream_status);
+		else if (args.sha256 && !download_sha256_matches(args.sha256))
+			fastboot_fail("Hash mismatch, %s already written", stream_label);
+		else {
+			ui_print(L"Flash done.");
+			fastboot_okay("");
+		}
+		stream_reset();
+		FreePool(label);
+		invalidate_provider(FLASH_PROGRESS);
+		return;
+	}
+
+	if (args.sha256 && !download_sha256_matches(args.sha256)) {
+		error(L"Downloaded data SHA-256 %a does not match", dl_sha256);
+		fastboot_fail("Hash mismatch");
+		FreePool(label);
+		return;
+	}
+
 	ui_print(L"Flashing %s ...", label);
 
-	ret = flash(dlbuffer, dlsize, label);
+	flash_set_discard(args.discard || flash_default(FLASH_DISCARD_VAR));
+	flash_set_digest(args.sha256 ? args.sha256 : dl_sha256);
+	flash_set_diff(args.diff);
+	flash_set_verify(args.verify || flash_default(FLASH_VERIFY_VAR));
+	ret = flash(&dlbuffer, label);
 	FreePool(label);
+	invalidate_provider(FLASH_PROGRESS);
 	if (EFI_ERROR(ret))
 		fastboot_fail("Flash failure: %r", ret);
 	else {
@@ -300,12 +725,51 @@ static void cmd_flash(INTN argc, CHAR8 **argv)
 		fastboot_okay("");
 		/* update partition variable in case it has changed */
 		if (ret & REFRESH_PARTITION_VAR) {
-			clean_partition_var();
-			publish_partsize();
+			invalidate_provider(MATCH_PART);
 		}
 	}
 }
 
+/* Resume an interrupted flash, the downloaded data is the rest of the
+ * image starting at the offset given by "getvar:flash-progress" */
+static void cmd_flash_resume(INTN argc, CHAR8 **argv)
+{
+	EFI_STATUS ret;
+	CHAR16 *label;
+	struct flash_args args;
+
+	if (argc != 2 || stream_label) {
+		fastboot_fail("Invalid parameter");
+		return;
+	}
+
+	ret = parse_flash_args(argv[1], &args);
+	if (EFI_ERROR(ret)) {
+		fastboot_fail("Invalid parameter");
+		return;
+	}
+
+	label = stra_to_str(args.label);
+	if (!label) {
+		error(L"Failed to get label %a", args.label);
+		fastboot_fail("Allocation error");
+		return;
+	}
+
+	ui_print(L"Resuming flash of %s ...", label);
+	flash_set_verify(args.verify || flash_default(FLASH_VERIFY_VAR));
+
+	ret = flash_resume(&dlbuffer, label, args.sha256);
+	FreePool(label);
+	invalidate_provider(FLASH_PROGRESS);
+	if (EFI_ERROR(ret))
+		fastboot_fail("Flash failure: %r", ret);
+	else {
+		ui_print(L"Flash done.");
+		fastboot_okay("");
+	}
+}
+
 static void cmd_erase(INTN argc, CHAR8 **argv)
 {
 	EFI_STATUS ret;
@@ -338,7 +802,16 @@ static void cmd_erase(INTN argc, CHAR8 **argv)
 static void cmd_boot(__attribute__((__unused__)) INTN argc,
 		     __attribute__((__unused__)) CHAR8 **argv)
 {
-	fastboot_usb_stop(dlbuffer, NULL, 0, UNKNOWN_TARGET);
+	EFI_STATUS ret;
+	VOID *bootimage;
+
+	ret = sglist_flatten(&dlbuffer, &bootimage);
+	if (EFI_ERROR(ret)) {
+		fastboot_fail("Failed to get the boot image: %r", ret);
+		return;
+	}
+
+	fastboot_usb_stop(bootimage, NULL, 0, UNKNOWN_TARGET);
 	ui_print(L"Booting received image ...");
 	fastboot_okay("");
 }
@@ -352,8 +825,10 @@ static void worker_getvar_all(struct fastboot_var *start)
 	if (var) {
 		fastboot_info("%a: %a", var->name, var->value);
 		var = var->next;
-	} else
+	} else {
 		fastboot_okay("");
+		stats.getvar_all_us = uefi_get_us() - stats.getvar_all_start_us;
+	}
 }
 
 static void cmd_getvar(INTN argc, CHAR8 **argv)
@@ -365,11 +840,13 @@ static void cmd_getvar(INTN argc, CHAR8 **argv)
 
 	if (!strcmp(argv[1], (CHAR8 *)"all")) {
 		fastboot_state = STATE_GETVAR;
+		stats.getvar_all_start_us = uefi_get_us();
+		complete_providers();
 		worker_getvar_all(varlist);
 	} else {
 		struct fastboot_var *var;
 		var = fastboot_getvar((char *)argv[1]);
-		if (var && var->value) {
+		if (var) {
 			fastboot_okay("%a", var->value);
 		} else {
 			fastboot_okay("");
@@ -408,28 +885,47 @@ static void cmd_reboot_bootloader(__attribute__((__unused__)) INTN argc,
 	reboot();
 }
 
-static struct fastboot_cmd *get_cmd(struct fastboot_cmd *list, const CHAR8 *name)
+/* Find the command with the longest prefix of NAME.  Restricted
+ * commands are only available on unlocked devices. */
+static EFI_STATUS get_cmd(struct cmd_node *tree, const CHAR8 *name,
+			  struct fastboot_cmd **cmd)
 {
-	struct fastboot_cmd *cmd;
-	for (cmd = list; cmd; cmd = cmd->next)
-		if (!memcmp(name, cmd->prefix, cmd->prefix_len)) {
-			return cmd;
-		}
+	struct cmd_node *node;
+
+	*cmd = NULL;
+	for (node = tree; *name; name++) {
+		node = cmd_node_child(node, *name);
+		if (!node)
+			break;
+		if (node->cmd)
+			*cmd = node->cmd;
+	}
 
-	return NULL;
+	if (!*cmd)
+		return EFI_NOT_FOUND;
+
+	if ((*cmd)->restricted && get_current_state() != UNLOCKED)
+		return EFI_ACCESS_DENIED;
+
+	return EFI_SUCCESS;
 }
 
 static void cmd_oem(INTN argc, CHAR8 **argv)
 {
 	struct fastboot_cmd *cmd;
+	EFI_STATUS ret;
 
 	if (argc < 2) {
 		fastboot_fail("Invalid parameter");
 		return;
 	}
 
-	cmd = get_cmd(oem_cmdlist, argv[1]);
-	if (!cmd) {
+	ret = get_cmd(&oem_cmdtree, argv[1], &cmd);
+	if (ret == EFI_ACCESS_DENIED) {
+		fastboot_fail("'oem %a' not allowed on a locked device", argv[1]);
+		return;
+	}
+	if (EFI_ERROR(ret)) {
 		fastboot_fail("unknown command 'oem %a'", argv[1]);
 		return;
 	}
@@ -439,15 +935,315 @@ static void cmd_oem(INTN argc, CHAR8 **argv)
 
 static void fastboot_read_command(void)
 {
-	usb_read(command_buffer, sizeof(command_buffer));
+	usb_read(command_buffer, COMMAND_BUFFER_LENGTH);
 }
 #define BLK_DOWNLOAD (8*1024*1024)
 
+static void cmd_oem_stream_flash(INTN argc, CHAR8 **argv)
+{
+	UINTN i;
+
+	if (argc != 2) {
+		fastboot_fail("Invalid parameter");
+		return;
+	}
+
+	stream_reset();
+	stream_label = stra_to_str(argv[1]);
+	if (!stream_label) {
+		fastboot_fail("Allocation error");
+		return;
+	}
+
+	for (i = 0; i < STREAM_BUFFERS; i++) {
+		if (stream_buffers[i])
+			continue;
+		stream_buffers[i] = AllocatePool(BLK_DOWNLOAD);
+		if (!stream_buffers[i]) {
+			error(L"Failed to allocate stream buffer");
+			stream_reset();
+			fastboot_fail("Memory allocation failure");
+			return;
+		}
+	}
+
+	fastboot_okay("");
+}
+
+static void cmd_oem_protocol_stats(INTN argc, CHAR8 **argv)
+{
+	UINT64 rate = 0;
+
+	if (argc == 2 && !strcmp(argv[1], (CHAR8 *)"reset")) {
+		ZeroMem(&stats, sizeof(stats));
+		fastboot_okay("");
+		return;
+	}
+	if (argc != 1) {
+		fastboot_fail("Invalid parameter");
+		return;
+	}
+
+	/* Do not account for this command in the results */
+	stats.cmd_pending = FALSE;
+
+	fastboot_info("commands: %d", stats.commands);
+	if (stats.commands)
+		fastboot_info("command latency: avg %ld us, max %ld us",
+			      stats.cmd_total_us / stats.commands, stats.cmd_max_us);
+	fastboot_info("getvar all: %ld us", stats.getvar_all_us);
+
+	if (stats.download_ms)
+		rate = (stats.download_bytes * 1000 * 100 / stats.download_ms) / MiB;
+	fastboot_info("downloads: %d, %ld MiB in %ld ms", stats.downloads,
+		      stats.download_bytes / MiB, stats.download_ms);
+	fastboot_info("download rate: %ld.%02ld MiB/s", rate / 100, rate % 100);
+	fastboot_okay("");
+}
+
+static EFI_STATUS stream_download(void)
+{
+	ui_print(L"Streaming %d bytes to %s ...", dl_expected, stream_label);
+	flash_set_discard(flash_default(FLASH_DISCARD_VAR));
+	flash_set_digest(NULL);
+	flash_set_diff(FALSE);
+	flash_set_verify(flash_default(FLASH_VERIFY_VAR));
+	stream_status = flash_stream_open(stream_label);
+	if (EFI_ERROR(stream_status)) {
+		fastboot_fail("Cannot stream to partition: %r", stream_status);
+		stream_reset();
+		return stream_status;
+	}
+	stream_done = FALSE;
+
+	return EFI_SUCCESS;
+}
+
+static void publish_max_download_size(void)
+{
+	char download_max_str[30];
+
+	max_download_size = sglist_free_memory() + dlbuffer.capacity;
+	if (max_download_size > DOWNLOAD_RESERVED_MEMORY)
+		max_download_size -= DOWNLOAD_RESERVED_MEMORY;
+	else
+		max_download_size = 0;
+	max_download_size = MIN(max_download_size, MAX_DOWNLOAD_SIZE);
+
+	if (EFI_ERROR(snprintf((CHAR8 *)download_max_str, sizeof(download_max_str),
+			       (CHAR8 *)"0x%lX", max_download_size)))
+		debug(L"Failed to set download_max_str string");
+	else
+		fastboot_publish("max-download-size", download_max_str);
+}
+
+static EFI_STATUS download_buffer_alloc(UINTN newdlsize)
+{
+	EFI_STATUS ret;
+
+	ui_print(L"Receiving %d bytes ...", newdlsize);
+	if (newdlsize > max_download_size) {
+		fastboot_fail("data too large");
+		return EFI_BAD_BUFFER_SIZE;
+	}
+
+	ret = sglist_alloc(&dlbuffer, newdlsize);
+	if (EFI_ERROR(ret)) {
+		error(L"Failed to allocate download buffer (0x%x bytes)", newdlsize);
+		fastboot_fail("Memory allocation failure");
+		return ret;
+	}
+
+	return EFI_SUCCESS;
+}
+
+/* Return where the next reception request goes and its length, at
+ * most BLK_DOWNLOAD bytes and never across two extents. */
+static void *download_dest(unsigned *len)
+{
+	struct sg_entry *entry;
+	void *dest;
+
+	*len = MIN(dl_expected - dl_queued, BLK_DOWNLOAD);
+	if (stream_label)
+		return stream_buffers[(dl_queued / BLK_DOWNLOAD) % STREAM_BUFFERS];
+
+	entry = &dlbuffer.entries[dl_entry];
+	*len = MIN(*len, entry->size - dl_entry_offset);
+	dest = (CHAR8 *)entry->data + dl_entry_offset;
+
+	dl_entry_offset += *len;
+	if (dl_entry_offset == entry->size) {
+		dl_entry++;
+		dl_entry_offset = 0;
+	}
+
+	return dest;
+}
+
+/* Keep up to DOWNLOAD_QUEUE_DEPTH reception requests queued on the
+ * OUT endpoint so that the controller does not wait for us between
+ * two transfers. */
+static int download_queue(void)
+{
+	unsigned len;
+	void *dest;
+
+	while (dl_queued < dl_expected && dl_pending < DOWNLOAD_QUEUE_DEPTH) {
+		dest = download_dest(&len);
+		if (usb_read(dest, len))
+			return -1;
+		dl_requests[(dl_first + dl_pending) % DOWNLOAD_QUEUE_DEPTH] = len;
+		dl_pending++;
+		dl_queued += len;
+	}
+
+	return 0;
+}
+
+static void publish_download_speed(void)
+{
+	char speed[MAX_VARIABLE_LENGTH];
+	UINT64 elapsed, rate;
+
+	elapsed = uefi_get_ms() - dl_start_ms;
+	if (!elapsed)
+		elapsed = 1;
+	/* Hundredths of MiB per second */
+	rate = ((UINT64)dl_expected * 1000 * 100 / elapsed) / MiB;
+
+	debug(L"Received %d bytes in %ld ms", dl_expected, elapsed);
+	stats.downloads++;
+	stats.download_bytes += dl_expected;
+	stats.download_ms += elapsed;
+
+	if (EFI_ERROR(snprintf((CHAR8 *)speed, sizeof(speed),
+			       (CHAR8 *)"%ld.%02ld MiB/s", rate / 100, rate % 100)))
+		return;
+
+	fastboot_publish("download-speed", speed);
+}
+
+static void publish_download_sha256(void)
+{
+	UINT8 hash[SHA256_DIGEST_LENGTH];
+	CHAR8 half[SHA256_DIGEST_LENGTH + 1];
+	CHAR8 *pos;
+	UINT8 hex;
+	UINTN i;
+
+	SHA256_Final(hash, &dl_sha256_ctx);
+	for (i = 0, pos = dl_sha256; i < SHA256_DIGEST_LENGTH * 2; i++) {
+		hex = (i & 1) ? hash[i / 2] & 0xf : hash[i / 2] >> 4;
+		*pos++ = hex > 9 ? hex + 'a' - 10 : hex + '0';
+	}
+	*pos = '\0';
+
+	/* A reply cannot hold the 64 digits, they are published in two
+	 * halves */
+	memcpy(half, dl_sha256, SHA256_DIGEST_LENGTH);
+	half[SHA256_DIGEST_LENGTH] = '\0';
+	fastboot_publish("download-sha256:0", (char *)half);
+	fastboot_publish("download-sha256:1", (char *)dl_sha256 + SHA256_DIGEST_LENGTH);
+}
+
+static void download_done(void)
+{
+	EFI_STATUS ret = EFI_SUCCESS;
+
+	publish_download_speed();
+	publish_download_sha256();
+	fastboot_state = STATE_COMMAND;
+
+	if (stream_label) {
+		if (!EFI_ERROR(stream_status))
+			stream_status = flash_stream_close();
+		stream_done = TRUE;
+		ret = stream_status;
+	}
+
+	if (EFI_ERROR(ret))
+		fastboot_fail("Stream flash failure: %r", ret);
+	else
+		fastboot_okay("");
+}
+
+/* The USB device protocol cannot cancel the reception requests still
+ * queued: the next host transfers would complete them, in the
+ * download buffer.  Their completions are swallowed, and the next
+ * command is read once they are all done and the FAIL is sent. */
+static void download_abort(void)
+{
+	fastboot_fail("Usb receive failed");
+	stream_reset();
+	if (dl_pending && fastboot_state != STATE_ERROR) {
+		dl_abort_acked = FALSE;
+		fastboot_state = STATE_DOWNLOAD_ABORT;
+	}
+}
+
+static void download_drain_rx(void)
+{
+	dl_first = (dl_first + 1) % DOWNLOAD_QUEUE_DEPTH;
+	dl_pending--;
+
+	if (dl_pending)
+		return;
+
+	/* Otherwise the FAIL completion reads the next command */
+	fastboot_state = STATE_COMPLETE;
+	if (dl_abort_acked)
+		fastboot_read_command();
+}
+
+static void download_process_rx(void *buf, unsigned len)
+{
+	unsigned requested;
+
+	requested = dl_requests[dl_first];
+	dl_first = (dl_first + 1) % DOWNLOAD_QUEUE_DEPTH;
+	dl_pending--;
+
+	dl_received += len;
+	if (dl_expected > MiB)
+		debug(L"\rRX %d MiB / %d MiB", dl_received / MiB, dl_expected / MiB);
+	else
+		debug(L"\rRX %d KiB / %d KiB", dl_received / 1024, dl_expected / 1024);
+
+	/* Requests are laid out one after the other: a short transfer
+	 * before the end would shift all the following ones. */
+	if (dl_received < dl_expected && len != requested) {
+		error(L"Short transfer, %d bytes received", len);
+		download_abort();
+		return;
+	}
+
+	SHA256_Update(&dl_sha256_ctx, buf, len);
+
+	/* In streaming mode, the buffer is written before being
+	 * queued again while the other requests keep the endpoint
+	 * busy.  On error, keep receiving but drop the data, the
+	 * failure is reported once the host is done sending. */
+	if (stream_label && !EFI_ERROR(stream_status))
+		stream_status = flash_stream_write(buf, len);
+
+	if (dl_received >= dl_expected) {
+		download_done();
+		return;
+	}
+
+	if (download_queue()) {
+		error(L"Failed to receive %d bytes", dl_expected);
+		download_abort();
+	}
+}
+
 static void cmd_download(INTN argc,
 			 CHAR8 **argv)
 {
 	char response[MAGIC_LENGTH];
 	UINTN newdlsize;
+	EFI_STATUS ret;
 
 	if (argc != 2) {
 		fastboot_fail("Invalid parameter");
@@ -456,49 +1252,94 @@ static void cmd_download(INTN argc,
 
 	newdlsize = strtoul((const char *)argv[1], NULL, 16);
 
-	ui_print(L"Receiving %d bytes ...", newdlsize);
 	if (newdlsize == 0) {
 		fastboot_fail("no data to download");
 		return;
-	} else if (newdlsize > MAX_DOWNLOAD_SIZE) {
-		fastboot_fail("data too large");
+	}
+
+	/* "oem stream-flash" arms a single download: once streamed,
+	 * successfully or not, the stream is never opened again, which
+	 * would restart the journal of the partition. */
+	if (stream_label && stream_done)
+		stream_reset();
+
+	dl_expected = newdlsize;
+	if (stream_label)
+		ret = stream_download();
+	else
+		ret = download_buffer_alloc(newdlsize);
+	if (EFI_ERROR(ret))
+		return;
+
+	sprintf(response, "DATA%08x", dl_expected);
+	stats_command_response();
+	if (usb_write(response, strlen((CHAR8 *)response)) < 0) {
+		fastboot_state = STATE_ERROR;
 		return;
 	}
-	if (dlbuffer) {
-		if (newdlsize > dlsize) {
-			FreePool(dlbuffer);
-			dlbuffer = AllocatePool(newdlsize);
-		}
-	} else {
-		dlbuffer = AllocatePool(newdlsize);
+	fastboot_state = STATE_START_DOWNLOAD;
+}
+
+/* Data staged by a command for the host to fetch with "upload" */
+static VOID *upload_data;
+static UINTN upload_size;
+
+/* Stage DATA, allocated from the pool, which is now owned by this
+ * module */
+void fastboot_stage(VOID *data, UINTN size)
+{
+	if (upload_data)
+		FreePool(upload_data);
+	upload_data = data;
+	upload_size = size;
+}
+
+static void cmd_upload(INTN argc, __attribute__((__unused__)) CHAR8 **argv)
+{
+	char response[MAGIC_LENGTH];
+
+	if (argc != 1) {
+		fastboot_fail("Invalid parameter");
+		return;
 	}
-	if (!dlbuffer) {
-		error(L"Failed to allocate download buffer (0x%x bytes)", dlsize);
-		fastboot_fail("Memory allocation failure");
+
+	if (!upload_data) {
+		fastboot_fail("No data staged");
 		return;
 	}
-	dlsize = newdlsize;
 
-	sprintf(response, "DATA%08x", dlsize);
+	sprintf(response, "DATA%08x", upload_size);
+	stats_command_response();
 	if (usb_write(response, strlen((CHAR8 *)response)) < 0) {
 		fastboot_state = STATE_ERROR;
 		return;
 	}
-	fastboot_state = STATE_START_DOWNLOAD;
+	fastboot_state = STATE_START_UPLOAD;
 }
 
-static void worker_download(void)
+static void worker_upload(void)
 {
-	int len;
-
-	if (dlsize > BLK_DOWNLOAD)
-		len = BLK_DOWNLOAD;
-	else
-		len = dlsize;
+	fastboot_state = STATE_UPLOAD;
+	if (usb_write(upload_data, upload_size) < 0)
+		fastboot_state = STATE_ERROR;
+}
 
-	if (usb_read(dlbuffer, len)) {
-		error(L"Failed to receive %d bytes", dlsize);
+static void worker_download(void)
+{
+	dl_queued = 0;
+	dl_received = 0;
+	dl_pending = 0;
+	dl_first = 0;
+	dl_entry = 0;
+	dl_entry_offset = 0;
+	dl_start_ms = uefi_get_ms();
+	dl_sha256[0] = '\0';
+	SHA256_Init(&dl_sha256_ctx);
+
+	if (download_queue()) {
+		error(L"Failed to receive %d bytes", dl_expected);
 		fastboot_fail("Usb receive failed");
+		stream_reset();
 		return;
 	}
 	fastboot_state = STATE_DOWNLOAD;
@@ -507,6 +1348,12 @@ static void worker_download(void)
 static void fastboot_process_tx(__attribute__((__unused__)) void *buf,
 				__attribute__((__unused__)) unsigned len)
 {
+	if (infos_pending) {
+		infos_pending--;
+		if (fastboot_state == STATE_COMPLETE)
+			return;
+	}
+
 	switch (fastboot_state) {
 	case STATE_GETVAR:
 		worker_getvar_all(NULL);
@@ -517,6 +1364,15 @@ static void fastboot_process_tx(__attribute__((__unused__)) void *buf,
 	case STATE_START_DOWNLOAD:
 		worker_download();
 		break;
+	case STATE_START_UPLOAD:
+		worker_upload();
+		break;
+	case STATE_UPLOAD:
+		fastboot_okay("");
+		break;
+	case STATE_DOWNLOAD_ABORT:
+		dl_abort_acked = TRUE;
+		break;
 	default:
 		/* Nothing to do */
 		break;
@@ -525,6 +1381,11 @@ static void fastboot_process_tx(__attribute__((__unused__)) void *buf,
 
 #define MAX_ARGS 64
 
+static BOOLEAN is_flash_command(struct fastboot_cmd *cmd)
+{
+	return cmd->handle == cmd_flash || cmd->handle == cmd_flash_resume;
+}
+
 static void split_args(CHAR8 *str, INTN *argc, CHAR8 *argv[])
 {
 	argv[0] = str;
@@ -543,47 +1404,41 @@ static void split_args(CHAR8 *str, INTN *argc, CHAR8 *argv[])
 static void fastboot_process_rx(void *buf, unsigned len)
 {
 	struct fastboot_cmd *cmd;
-	static unsigned received_len = 0;
-	CHAR8 *s;
 	CHAR8 *argv[MAX_ARGS];
 	INTN argc;
-	int req_len;
+	EFI_STATUS ret;
 
 	switch (fastboot_state) {
 	case STATE_DOWNLOAD:
-		received_len += len;
-		if (dlsize > MiB)
-			debug(L"\rRX %d MiB / %d MiB", received_len/MiB, dlsize / MiB);
-		else
-			debug(L"\rRX %d KiB / %d KiB", received_len/1024, dlsize / 1024);
-		if (received_len < dlsize) {
-			s = buf;
-			req_len = dlsize - received_len;
-			if (req_len > BLK_DOWNLOAD)
-				req_len = BLK_DOWNLOAD;
-			usb_read(&s[len], req_len);
-		} else {
-			fastboot_state = STATE_COMMAND;
-			fastboot_okay("");
-		}
+		download_process_rx(buf, len);
+		break;
+	case STATE_DOWNLOAD_ABORT:
+		download_drain_rx();
 		break;
 	case STATE_COMPLETE:
 		((CHAR8 *)buf)[len] = 0;
 		debug(L"GOT %a", (CHAR8 *)buf);
 
 		fastboot_state = STATE_COMMAND;
-
-		cmd = get_cmd(cmdlist, buf);
-		if (cmd) {
+		stats_command_start();
+
+		ret = get_cmd(&cmdtree, buf, &cmd);
+		if (!EFI_ERROR(ret) && len > MAGIC_LENGTH &&
+		    (len > MAX_FLASH_COMMAND_LENGTH || !is_flash_command(cmd))) {
+			error(L"command '%a' too long", buf);
+			fastboot_fail("command too long");
+		} else if (ret == EFI_ACCESS_DENIED) {
+			error(L"command '%a' not allowed on a locked device", buf);
+			fastboot_fail("command not allowed on a locked device");
+		} else if (EFI_ERROR(ret)) {
+			error(L"unknown command '%a'", buf);
+			fastboot_fail("unknown command");
+		} else {
 			split_args(buf, &argc, argv);
 			cmd->handle(argc, argv);
-			received_len = 0;
 
 			if (fastboot_state == STATE_COMMAND)
 				fastboot_fail("unknown reason");
-		} else {
-			error(L"unknown command '%a'", buf);
-			fastboot_fail("unknown command");
 		}
 		break;
 	default:
@@ -594,6 +1449,10 @@ static void fastboot_process_rx(void *buf, unsigned len)
 static void fastboot_start_callback(void)
 {
 	fastboot_state = STATE_COMPLETE;
+	infos_pending = 0;
+	dl_pending = 0;
+	/* A stream armed before the host went away is not resumed */
+	stream_reset();
 	fastboot_read_command();
 }
 
@@ -601,32 +1460,34 @@ EFI_STATUS fastboot_start(void **bootimage, void **efiimage, UINTN *imagesize,
 			  enum boot_target *target)
 {
 	EFI_STATUS ret;
-	char download_max_str[30];
 
 	if (info_product() != INFO_UNDEFINED)
 		fastboot_publish("product", info_product());
 	fastboot_publish("version-bootloader", info_bootloader_version());
 	publish_intel_variables();
-
-	if (EFI_ERROR(snprintf((CHAR8 *)download_max_str, sizeof(download_max_str),
-			       (CHAR8 *)"0x%lX", MAX_DOWNLOAD_SIZE)))
-		debug(L"Failed to set download_max_str string");
-	else
-		fastboot_publish("max-download-size", download_max_str);
+	publish_max_download_size();
+	/* Compression formats flash:<label> decompresses on the fly */
+	fastboot_publish("flash-codecs", "lz4");
 
 	fastboot_register("download:", cmd_download, TRUE);
 	fastboot_register("flash:", cmd_flash, TRUE);
+	fastboot_register("flash-resume:", cmd_flash_resume, TRUE);
 	fastboot_register("erase:", cmd_erase, TRUE);
+	fastboot_register("upload", cmd_upload, FALSE);
 	fastboot_register("getvar:", cmd_getvar, FALSE);
 	fastboot_register("boot", cmd_boot, TRUE);
 	fastboot_register("continue", cmd_continue, FALSE);
 	fastboot_register("reboot", cmd_reboot, FALSE);
 	fastboot_register("reboot-bootloader", cmd_reboot_bootloader, FALSE);
 
-	publish_partsize();
+	fastboot_register_provider(MATCH_PART, publish_partition_vars);
+	fastboot_register_provider(FLASH_PROGRESS, publish_flash_progress);
+	fastboot_register_provider(MATCH_STORAGE, publish_storage_vars);
 
 	fastboot_register("oem", cmd_oem, FALSE);
 	fastboot_oem_init();
+	fastboot_oem_register("stream-flash", cmd_oem_stream_flash, TRUE);
+	fastboot_oem_register("protocol-stats", cmd_oem_protocol_stats, FALSE);
 	ret = fastboot_ui_init();
 	if (EFI_ERROR(ret))
 		efi_perror(ret, "Fastboot UI initialization failed, continue anyway.");
@@ -158,6 +158,86 @@ static void cmd_oem_gethashes(__attribute__((__unused__)) INTN argc,
 	fastboot_okay("");
 }
 
+/* "oem partition-manifest <label>", the manifest is then fetched
+ * with "upload" */
+static void cmd_oem_partition_manifest(INTN argc, CHAR8 **argv)
+{
+	struct partition_manifest *manifest;
+	CHAR8 *name;
+	CHAR16 *label;
+	UINTN size;
+	EFI_STATUS ret;
+
+	/* Also accept the "partition-manifest:<label>" form */
+	for (name = argv[0]; *name && *name != ':'; name++)
+		;
+	if (argc == 1 && *name)
+		name++;
+	else if (argc == 2)
+		name = argv[1];
+	else {
+		fastboot_fail("Invalid parameter");
+		return;
+	}
+
+	label = stra_to_str(name);
+	if (!label) {
+		fastboot_fail("Allocation error");
+		return;
+	}
+
+	ret = get_partition_manifest(label, (VOID **)&manifest, &size);
+	FreePool(label);
+	if (EFI_ERROR(ret)) {
+		fastboot_fail("Failed to compute the manifest, %r", ret);
+		return;
+	}
+
+	fastboot_info("%ld stripes of %d KiB", manifest->stripe_count,
+		      manifest->stripe_size / 1024);
+	fastboot_stage(manifest, size);
+	fastboot_okay("");
+}
+
+static void report_io_stats(const char *name, const struct io_stats *io)
+{
+	UINT64 rate = 0;
+
+	/* Hundredths of MiB per second, computed from KiB so that
+	 * the intermediate product does not overflow */
+	if (io->us)
+		rate = (io->bytes / 1024 * 1000000 / io->us) * 100 / 1024;
+
+	fastboot_info("%a: %d, %ld KiB, %ld ms, %ld.%02ld MiB/s", name,
+		      io->count, io->bytes / 1024, io->us / 1000,
+		      rate / 100, rate % 100);
+}
+
+static void cmd_oem_storage_stats(INTN argc, CHAR8 **argv)
+{
+	const struct storage_stats *stats = storage_get_stats();
+	UINTN i;
+
+	if (argc == 2 && !strcmp(argv[1], (CHAR8 *)"reset")) {
+		storage_reset_stats();
+		fastboot_okay("");
+		return;
+	}
+	if (argc != 1) {
+		fastboot_fail("Invalid parameter");
+		return;
+	}
+
+	report_io_stats("write", &stats->write);
+	report_io_stats("read", &stats->read);
+	report_io_stats("erase", &stats->erase);
+	for (i = 0; i < ERASE_BACKEND_COUNT; i++)
+		if (stats->erase_backend[i].count)
+			report_io_stats(erase_backend_name(i), &stats->erase_backend[i]);
+	fastboot_info("skipped: %ld KiB", stats->skip_bytes / 1024);
+	fastboot_okay("");
+}
+
 void fastboot_oem_init(void)
 {
 	fastboot_oem_publish();
@@ -171,4 +251,6 @@ void fastboot_oem_init(void)
 	fastboot_oem_register("garbage-disk", cmd_oem_garbage_disk, TRUE);
 	fastboot_oem_register("reboot", cmd_oem_reboot, FALSE);
 	fastboot_oem_register("get-hashes", cmd_oem_gethashes, FALSE);
+	fastboot_oem_register("partition-manifest", cmd_oem_partition_manifest, TRUE);
+	fastboot_oem_register("storage-stats", cmd_oem_storage_stats, FALSE);
 }
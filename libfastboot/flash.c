@@ -37,6 +37,7 @@
 #include <lib.h>
 #include <fastboot.h>
 #include <openssl/rand.h>
+#include <openssl/sha.h>
 #include <android.h>
 
 #include "fastboot_usb.h"
@@ -44,9 +45,11 @@
 #include "gpt.h"
 #include "gpt_bin.h"
 #include "flash.h"
-#include "SdHostIo.h"
+#include "storage.h"
 #include "Mmc.h"
 #include "sparse.h"
+#include "lz4.h"
+#include "chacha20.h"
 #include "oemvars.h"
 
 #define KEYSTORE_VAR L"KeyStore"
@@ -60,19 +63,557 @@ static UINT64 cur_offset;
 #define is_inside_partition(off, sz) \
 		(off >= part_start && off + sz <= part_end)
 
+/* The disk accesses of this module go through the helpers below,
+ * which account for them in the storage statistics. */
+static struct storage_stats stats;
+
+static void stats_account(struct io_stats *io, UINT64 bytes, UINT64 start_us)
+{
+	io->count++;
+	io->bytes += bytes;
+	io->us += uefi_get_us() - start_us;
+}
+
+static EFI_STATUS disk_write(struct gpt_partition_interface *parti,
+			     UINT64 offset, UINTN size, VOID *data)
+{
+	return storage_write(parti->bio, parti->dio, offset, size, data, &stats.write);
+}
+
+static EFI_STATUS disk_read(struct gpt_partition_interface *parti,
+			    UINT64 offset, UINTN size, VOID *data)
+{
+	return storage_read(parti->bio, parti->dio, offset, size, data, &stats.read);
+}
+
+const struct storage_stats *storage_get_stats(void)
+{
+	return &stats;
+}
+
+void storage_reset_stats(void)
+{
+	ZeroMem(&stats, sizeof(stats));
+}
+
+/* Discard mode: skipped ranges are erased rather than left with
+ * stale data.  Contiguous ranges are merged so that erase_blocks() can
+ * use the erase group aligned TRIM or erase on most of them. */
+static BOOLEAN discard;
+static UINT64 discard_offset;
+static UINT64 discard_len;
+
+void flash_set_discard(BOOLEAN enabled)
+{
+	discard = enabled;
+}
+
+static EFI_STATUS verify_hash_pending(void);
+
+static EFI_STATUS discard_flush(void)
+{
+	UINTN block_size = gparti.bio->Media->BlockSize;
+	UINT64 start, end;
+	EFI_STATUS ret;
+
+	if (!discard_len)
+		return EFI_SUCCESS;
+
+	/* The erase must not be issued while coalesced writes or the
+	 * verify mode read back are still in progress */
+	ret = flash_flush();
+	if (EFI_ERROR(ret))
+		return ret;
+	ret = verify_hash_pending();
+	if (EFI_ERROR(ret))
+		return ret;
+
+	start = (discard_offset + block_size - 1) / block_size;
+	end = (discard_offset + discard_len) / block_size;
+	discard_len = 0;
+	if (end <= start)
+		return EFI_SUCCESS;
+
+	ret = erase_blocks(gparti.bio, start, end - 1, ERASE_DISCARD);
+	if (EFI_ERROR(ret))
+		efi_perror(ret, L"Failed to discard blocks %ld to %ld", start, end - 1);
+	return ret;
+}
+
 EFI_STATUS flash_skip(UINT64 size)
 {
+	EFI_STATUS ret;
+
 	if (!is_inside_partition(cur_offset, size)) {
 		error(L"Attempt to skip outside of partition [%ld %ld] [%ld %ld]",
 				part_start, part_end, cur_offset, cur_offset + size);
 		return EFI_INVALID_PARAMETER;
 	}
+	if (discard) {
+		if (discard_len && discard_offset + discard_len != cur_offset) {
+			ret = discard_flush();
+			if (EFI_ERROR(ret))
+				return ret;
+		}
+		if (!discard_len)
+			discard_offset = cur_offset;
+		discard_len += size;
+	}
 	cur_offset += size;
+	stats.skip_bytes += size;
+	return EFI_SUCCESS;
+}
+
+/* Diff mode: the disk content is read back and only the stripes
+ * which differ from the new data are written.  It spares time and
+ * wear when the partition already holds a close image, reads being
+ * much faster than writes.  The next region is read while the
+ * current one is compared. */
+#define DIFF_STRIPE (64 * 1024)
+#define DIFF_CHUNK (4 * MiB)
+
+static BOOLEAN diff;
+static CHAR8 *diff_buffer;
+static UINT64 diff_same;
+static UINT64 diff_written;
+
+void flash_set_diff(BOOLEAN enabled)
+{
+	diff = enabled;
+}
+
+static void diff_setup(void)
+{
+	diff_same = 0;
+	diff_written = 0;
+	if (!diff || diff_buffer)
+		return;
+
+	diff_buffer = storage_alloc(gparti.bio, 2 * DIFF_CHUNK);
+	if (!diff_buffer)
+		error(L"Diff mode disabled");
+}
+
+/* Compare by blocks of 32 words without early exit in a block so
+ * that the compiler can vectorize the inner loop */
+static BOOLEAN same_data(const VOID *a, const VOID *b, UINTN size)
+{
+	const UINT64 *x = a, *y = b;
+	UINT64 acc;
+	UINTN i;
+
+	for (; size >= 32 * sizeof(UINT64); size -= 32 * sizeof(UINT64)) {
+		acc = 0;
+		for (i = 0; i < 32; i++)
+			acc |= x[i] ^ y[i];
+		if (acc)
+			return FALSE;
+		x += 32;
+		y += 32;
+	}
+
+	return !CompareMem(x, y, size);
+}
+
+static EFI_STATUS diff_flush(UINT64 offset, UINTN size, CHAR8 *data)
+{
+	EFI_STATUS ret;
+
+	if (!size)
+		return EFI_SUCCESS;
+
+	ret = disk_write(&gparti, offset, size, data);
+	diff_written += size;
+	return ret;
+}
+
+/* Write the stripes of DATA which differ from DISK, the current
+ * content.  Changed stripes are gathered in runs starting at RUN. */
+static EFI_STATUS diff_compare(UINT64 offset, UINTN len, CHAR8 *data, CHAR8 *disk)
+{
+	UINTN i, stripe, run;
+	EFI_STATUS ret;
+
+	for (i = run = 0; i < len; i += stripe) {
+		stripe = MIN(DIFF_STRIPE, len - i);
+		if (!same_data(data + i, disk + i, stripe))
+			continue;
+
+		ret = diff_flush(offset + run, i - run, data + run);
+		if (EFI_ERROR(ret))
+			return ret;
+		diff_same += stripe;
+		run = i + stripe;
+	}
+
+	return diff_flush(offset + run, len - run, data + run);
+}
+
+static EFI_STATUS diff_write(UINT64 offset, UINTN size, CHAR8 *data)
+{
+	struct aio_request req;
+	CHAR8 *disk;
+	UINTN len, cur = 0;
+	EFI_STATUS ret;
+
+	if (!size)
+		return EFI_SUCCESS;
+
+	ret = aio_read(&req, gparti.bio, gparti.dio, offset, MIN(size, DIFF_CHUNK),
+		       diff_buffer, &stats.read);
+	for (; !EFI_ERROR(ret) && size; size -= len, offset += len, data += len) {
+		len = MIN(size, DIFF_CHUNK);
+		ret = aio_wait(&req);
+		if (EFI_ERROR(ret))
+			break;
+
+		disk = diff_buffer + cur * DIFF_CHUNK;
+		cur = !cur;
+		if (size > len) {
+			ret = aio_read(&req, gparti.bio, gparti.dio, offset + len,
+				       MIN(size - len, DIFF_CHUNK),
+				       diff_buffer + cur * DIFF_CHUNK, &stats.read);
+			if (EFI_ERROR(ret))
+				break;
+		}
+
+		ret = diff_compare(offset, len, data, disk);
+	}
+	aio_wait(&req);
+
+	return ret;
+}
+
+/* Verify mode: every write is read back once complete, and the read
+ * back data is hashed while the next writes are in progress.  At the
+ * end, the hash of the read back data must match the hash of the
+ * written data, and for raw images the download hash as well.
+ * Erased and skipped ranges are not verified. */
+#define VERIFY_CHUNK MiB
+
+static BOOLEAN verify;
+static BOOLEAN verify_active;
+static CHAR8 *verify_buffer;
+static struct aio_request verify_requests[2];
+static UINTN verify_lens[2];
+static UINTN verify_slot;
+static SHA256_CTX verify_written;
+static SHA256_CTX verify_read;
+static UINT64 verify_bytes;
+static CHAR8 verify_digest[FLASH_DIGEST_LEN + 1];
+
+void flash_set_verify(BOOLEAN enabled)
+{
+	verify = enabled;
+}
+
+static void verify_set_digest(const UINT8 *hash)
+{
+	CHAR8 *pos = verify_digest;
+	UINT8 hex;
+	UINTN i;
+
+	for (i = 0; i < SHA256_DIGEST_LENGTH * 2; i++) {
+		hex = (i & 1) ? hash[i / 2] & 0xf : hash[i / 2] >> 4;
+		*pos++ = hex > 9 ? hex + 'a' - 10 : hex + '0';
+	}
+	*pos = '\0';
+}
+
+static void verify_setup(void)
+{
+	/* Reads of an aborted stream may still be in progress */
+	aio_wait(&verify_requests[0]);
+	aio_wait(&verify_requests[1]);
+	ZeroMem(verify_lens, sizeof(verify_lens));
+
+	verify_active = FALSE;
+	verify_bytes = 0;
+	verify_digest[0] = '\0';
+	if (!verify)
+		return;
+
+	if (!verify_buffer) {
+		verify_buffer = storage_alloc(gparti.bio, 2 * VERIFY_CHUNK);
+		if (!verify_buffer) {
+			error(L"Verify mode disabled");
+			return;
+		}
+	}
+
+	SHA256_Init(&verify_written);
+	SHA256_Init(&verify_read);
+	verify_active = TRUE;
+}
+
+/* Hash the last read back chunk */
+static EFI_STATUS verify_hash_pending(void)
+{
+	EFI_STATUS ret;
+
+	if (!verify_lens[verify_slot])
+		return EFI_SUCCESS;
+
+	ret = aio_wait(&verify_requests[verify_slot]);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, "Failed to read back bytes");
+	} else {
+		SHA256_Update(&verify_read, verify_buffer + verify_slot * VERIFY_CHUNK,
+			      verify_lens[verify_slot]);
+		verify_bytes += verify_lens[verify_slot];
+	}
+	verify_lens[verify_slot] = 0;
+
+	return ret;
+}
+
+/* The data is hashed in the order it is submitted */
+static void verify_submit(VOID *data, UINTN size)
+{
+	if (verify_active)
+		SHA256_Update(&verify_written, data, size);
+}
+
+/* Read back a complete write, in the same order */
+static EFI_STATUS verify_complete(UINT64 offset, UINT64 size)
+{
+	UINTN next, len;
+	EFI_STATUS ret;
+
+	if (!verify_active)
+		return EFI_SUCCESS;
+
+	for (; size; offset += len, size -= len) {
+		len = MIN(size, VERIFY_CHUNK);
+		next = !verify_slot;
+		ret = aio_read(&verify_requests[next], gparti.bio, gparti.dio, offset, len,
+			       verify_buffer + next * VERIFY_CHUNK, &stats.read);
+		if (EFI_ERROR(ret)) {
+			efi_perror(ret, "Failed to read back bytes");
+			return ret;
+		}
+		verify_lens[next] = len;
+
+		ret = verify_hash_pending();
+		verify_slot = next;
+		if (EFI_ERROR(ret))
+			return ret;
+	}
+
+	return EFI_SUCCESS;
+}
+
+/* RAW is TRUE if the written data is the downloaded image itself */
+static EFI_STATUS verify_finish(BOOLEAN raw)
+{
+	UINT8 written[SHA256_DIGEST_LENGTH], read[SHA256_DIGEST_LENGTH];
+	CHAR8 expected[FLASH_DIGEST_LEN + 1];
+	EFI_STATUS ret;
+
+	if (!verify_active)
+		return EFI_SUCCESS;
+	verify_active = FALSE;
+
+	ret = verify_hash_pending();
+	if (EFI_ERROR(ret))
+		return ret;
+
+	SHA256_Final(written, &verify_written);
+	SHA256_Final(read, &verify_read);
+	if (CompareMem(written, read, sizeof(read))) {
+		error(L"The data read back differs from the data written");
+		return EFI_VOLUME_CORRUPTED;
+	}
+
+	if (raw && verify_digest[0]) {
+		memcpy(expected, verify_digest, sizeof(expected));
+		verify_set_digest(written);
+		if (memcmp(expected, verify_digest, FLASH_DIGEST_LEN)) {
+			error(L"The data written differs from the download");
+			return EFI_VOLUME_CORRUPTED;
+		}
+	}
+
+	fastboot_info("%ld KiB verified%a", verify_bytes / 1024,
+		      raw && verify_digest[0] ? " against the image hash" : "");
 	return EFI_SUCCESS;
 }
 
+/* All the image data is written through this function */
+static EFI_STATUS payload_write(UINT64 offset, UINTN size, VOID *data)
+{
+	EFI_STATUS ret;
+
+	verify_submit(data, size);
+	if (diff && diff_buffer)
+		ret = diff_write(offset, size, data);
+	else
+		ret = disk_write(&gparti, offset, size, data);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, "Failed to write bytes");
+		return ret;
+	}
+
+	return verify_complete(offset, size);
+}
+
+/* Write coalescing: contiguous writes are gathered in a buffer
+ * covering one stride of the disk, a multiple of the erase group
+ * size.  It is written when the stride is complete or as soon as the
+ * next write is not contiguous.  Writes spanning whole strides go
+ * straight to the disk.
+ *
+ * When the disk supports asynchronous I/O, a ring of AIO_QUEUE_DEPTH
+ * strides is used instead: a complete stride is queued and gathering
+ * goes on in the next one while the disk writes. */
+#define WC_MIN_SIZE MiB
+
+static UINTN erase_group_bytes(EFI_BLOCK_IO *bio)
+{
+	const struct storage_geometry *geo;
+
+	if (EFI_ERROR(storage_get_geometry(&geo)))
+		return 0;
+
+	return geo->erase_grp_size * bio->Media->BlockSize;
+}
+
+static CHAR8 *wc_pool;
+static UINTN wc_count;
+static UINTN wc_slot;
+static struct aio_request wc_requests[AIO_QUEUE_DEPTH];
+static UINT64 wc_request_offsets[AIO_QUEUE_DEPTH];
+static UINTN wc_request_lens[AIO_QUEUE_DEPTH];
+static CHAR8 *wc_buffer;
+static UINTN wc_size;
+static UINT64 wc_offset;
+static UINTN wc_len;
+
+/* Diff mode compares with the disk content before writing, the
+ * strides are not queued.  diff_write() overlaps its own reads. */
+static BOOLEAN wc_async(void)
+{
+	return wc_count > 1 && !(diff && diff_buffer);
+}
+
+/* Wait for the write queued in SLOT and read it back if needed */
+static EFI_STATUS wc_complete(UINTN slot)
+{
+	EFI_STATUS ret;
+
+	ret = aio_wait(&wc_requests[slot]);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, "Failed to write bytes");
+		return ret;
+	}
+
+	if (!wc_request_lens[slot])
+		return EFI_SUCCESS;
+
+	ret = verify_complete(wc_request_offsets[slot], wc_request_lens[slot]);
+	wc_request_lens[slot] = 0;
+	return ret;
+}
+
+/* Oldest first, so that the writes are read back in order */
+static EFI_STATUS wc_wait_all(void)
+{
+	EFI_STATUS ret = EFI_SUCCESS, status;
+	UINTN i;
+
+	for (i = 1; i <= wc_count; i++) {
+		status = wc_complete((wc_slot + i) % wc_count);
+		if (EFI_ERROR(status) && !EFI_ERROR(ret))
+			ret = status;
+	}
+
+	return ret;
+}
+
+static void wc_setup(void)
+{
+	UINTN grp, size, count;
+
+	/* Nothing of a previous stream is read back */
+	ZeroMem(wc_request_lens, sizeof(wc_request_lens));
+	wc_wait_all();
+	wc_len = 0;
+	wc_slot = 0;
+
+	grp = erase_group_bytes(gparti.bio);
+	size = grp ? ((WC_MIN_SIZE + grp - 1) / grp) * grp : WC_MIN_SIZE;
+	count = aio_available(gparti.bio) ? AIO_QUEUE_DEPTH : 1;
+	if (wc_pool && size == wc_size && count == wc_count)
+		goto out;
+
+	storage_free(wc_pool, wc_size * wc_count);
+	wc_pool = NULL;
+	wc_size = 0;
+	wc_count = 0;
+
+	while (count && !(wc_pool = storage_alloc(gparti.bio, size * count)))
+		count /= 2;
+	if (!wc_pool) {
+		error(L"Writes not coalesced");
+		return;
+	}
+
+	wc_size = size;
+	wc_count = count;
+	debug(L"Coalescing writes in %d KiB strides, %d buffers", wc_size / 1024, wc_count);
+
+out:
+	wc_buffer = wc_pool;
+}
+
+/* Write the gathered stride, queued if possible */
+static EFI_STATUS wc_submit(void)
+{
+	EFI_STATUS ret;
+
+	if (!wc_len)
+		return EFI_SUCCESS;
+
+	if (!wc_async()) {
+		ret = payload_write(wc_offset, wc_len, wc_buffer);
+		wc_len = 0;
+		return ret;
+	}
+
+	verify_submit(wc_buffer, wc_len);
+	ret = aio_write(&wc_requests[wc_slot], gparti.bio, gparti.dio,
+			wc_offset, wc_len, wc_buffer, &stats.write);
+	wc_request_offsets[wc_slot] = wc_offset;
+	wc_request_lens[wc_slot] = wc_len;
+	wc_len = 0;
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, "Failed to write bytes");
+		wc_request_lens[wc_slot] = 0;
+		return ret;
+	}
+
+	/* The next buffer of the ring must be written before reuse */
+	wc_slot = (wc_slot + 1) % wc_count;
+	wc_buffer = wc_pool + wc_slot * wc_size;
+	return wc_complete(wc_slot);
+}
+
+EFI_STATUS flash_flush(void)
+{
+	EFI_STATUS ret;
+
+	ret = wc_submit();
+	if (EFI_ERROR(ret))
+		return ret;
+
+	return wc_wait_all();
+}
+
 EFI_STATUS flash_write(VOID *data, UINTN size)
 {
+	CHAR8 *d = data;
+	UINT64 end;
+	UINTN len;
 	EFI_STATUS ret;
 
 	if (!gparti.bio)
@@ -83,30 +624,135 @@ EFI_STATUS flash_write(VOID *data, UINTN size)
 				part_start, part_end, cur_offset, cur_offset + size);
 		return EFI_INVALID_PARAMETER;
 	}
-	ret = uefi_call_wrapper(gparti.dio->WriteDisk, 5, gparti.dio, gparti.bio->Media->MediaId, cur_offset, size, data);
-	if (EFI_ERROR(ret))
-		efi_perror(ret, "Failed to write bytes");
 
-	cur_offset += size;
-	return ret;
+	if (!wc_size) {
+		ret = payload_write(cur_offset, size, data);
+		cur_offset += size;
+		return ret;
+	}
+
+	if (wc_len && wc_offset + wc_len != cur_offset) {
+		ret = wc_submit();
+		if (EFI_ERROR(ret))
+			return ret;
+	}
+
+	while (size) {
+		/* Queued writes cannot use the caller buffer, which
+		 * may be reused as soon as this function returns.  An
+		 * unaligned head is gathered up to the next stride
+		 * boundary before whole strides are written directly. */
+		if (!wc_len && !wc_async() && !(cur_offset % wc_size)) {
+			end = (cur_offset + size) / wc_size * wc_size;
+			if (end >= cur_offset + wc_size) {
+				len = end - cur_offset;
+				ret = payload_write(cur_offset, len, d);
+				if (EFI_ERROR(ret))
+					return ret;
+				d += len;
+				size -= len;
+				cur_offset += len;
+				continue;
+			}
+		}
+		if (!wc_len)
+			wc_offset = cur_offset;
+
+		len = MIN(size, wc_size - (wc_offset % wc_size) - wc_len);
+		CopyMem(wc_buffer + wc_len, d, len);
+		wc_len += len;
+		d += len;
+		size -= len;
+		cur_offset += len;
+
+		if (!((wc_offset + wc_len) % wc_size)) {
+			ret = wc_submit();
+			if (EFI_ERROR(ret))
+				return ret;
+		}
+	}
+
+	return EFI_SUCCESS;
 }
 
-EFI_STATUS flash_fill(UINT32 pattern, UINTN size)
+/* Fill engine: a page aligned buffer holding the last pattern is
+ * kept and written again and again, whatever the fill size. */
+#define FILL_BUFFER_SIZE (2 * MiB)
+
+static UINT32 *fill_buffer;
+static UINT32 fill_pattern;
+static BOOLEAN fill_ready;
+
+static VOID *fill_buffer_get(UINT32 pattern)
 {
-	UINT32 *buf;
 	UINTN i;
+
+	if (!fill_buffer) {
+		fill_buffer = storage_alloc(gparti.bio, FILL_BUFFER_SIZE);
+		if (!fill_buffer)
+			return NULL;
+		fill_ready = FALSE;
+	}
+
+	if (!fill_ready || pattern != fill_pattern) {
+		for (i = 0; i < FILL_BUFFER_SIZE / sizeof(*fill_buffer); i++)
+			fill_buffer[i] = pattern;
+		fill_pattern = pattern;
+		fill_ready = TRUE;
+	}
+
+	return fill_buffer;
+}
+
+EFI_STATUS flash_fill(UINT32 pattern, UINT64 size)
+{
+	UINTN block_size, len;
+	VOID *buf;
 	EFI_STATUS ret;
 
-	buf = AllocatePool(size);
+	if (!gparti.bio)
+		return EFI_INVALID_PARAMETER;
+
+	if (!is_inside_partition(cur_offset, size)) {
+		error(L"Attempt to fill outside of partition [%ld %ld] [%ld %ld]",
+				part_start, part_end, cur_offset, cur_offset + size);
+		return EFI_INVALID_PARAMETER;
+	}
+
+	/* Large zero fills are handed to the eMMC TRIM or erase when
+	 * the device reads erased blocks back as zeros.  In diff mode
+	 * they are compared like any other data instead. */
+	block_size = gparti.bio->Media->BlockSize;
+	if (!pattern && size >= FILL_BUFFER_SIZE && !(diff && diff_buffer) &&
+	    !(cur_offset % block_size) && !(size % block_size)) {
+		ret = flash_flush();
+		if (EFI_ERROR(ret))
+			return ret;
+		ret = erase_blocks(gparti.bio, cur_offset / block_size,
+				   (cur_offset + size) / block_size - 1, ERASE_ZEROES);
+		if (!EFI_ERROR(ret)) {
+			cur_offset += size;
+			return EFI_SUCCESS;
+		}
+		/* The zeros are written as any other pattern instead */
+		if (ret != EFI_UNSUPPORTED)
+			efi_perror(ret, L"Failed to erase blocks for a zero fill, writing them");
+	}
+
+	buf = fill_buffer_get(pattern);
 	if (!buf)
 		return EFI_OUT_OF_RESOURCES;
 
-	for (i = 0; i < size / sizeof(UINTN); i++)
-		buf[i] = pattern;
+	/* Strides end on FILL_BUFFER_SIZE boundaries of the disk, so
+	 * that writes stay aligned on the erase groups. */
+	for (; size; size -= len) {
+		len = MIN(size, FILL_BUFFER_SIZE - (cur_offset % FILL_BUFFER_SIZE));
+		ret = flash_write(buf, len);
+		if (EFI_ERROR(ret))
+			return ret;
+	}
 
-	ret = flash_write(buf, size);
-	FreePool(buf);
-	return ret;
+	return EFI_SUCCESS;
 }
 
 static EFI_STATUS flash_into_esp(VOID *data, UINTN size, CHAR16 *label)
@@ -137,202 +783,809 @@ static EFI_STATUS flash_gpt(VOID *data, UINTN size)
 	if (size != sizeof(*gb_hdr) + gb_hdr->npart * sizeof(*gb_part))
 		return EFI_INVALID_PARAMETER;
 
-	ret = gpt_create(gb_hdr->start_lba, gb_hdr->npart, gb_part);
-	if (EFI_ERROR(ret))
-		return ret;
+	ret = gpt_create(gb_hdr->start_lba, gb_hdr->npart, gb_part);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	return (EFI_SUCCESS | REFRESH_PARTITION_VAR);
+}
+
+/***
+static EFI_STATUS flash_keystore(VOID *data, UINTN size)
+{
+	EFI_STATUS ret;
+
+	if (size) {
+		struct keystore *ks = get_keystore(data, size);
+
+		if (!ks) {
+			error(L"keystore data is invalid");
+			return EFI_INVALID_PARAMETER;
+		}
+
+		free_keystore(ks);
+	}
+
+	ret = set_efi_variable(&fastboot_guid, KEYSTORE_VAR,
+			       size, data, TRUE, FALSE);
+	if (ret)
+		efi_perror(ret, "Coudn't modify KeyStore");
+
+	return ret;
+}
+***/
+
+static EFI_STATUS flash_efirun(VOID *data, UINTN size)
+{
+	return fastboot_usb_stop(NULL, data, size, UNKNOWN_TARGET);
+}
+
+static EFI_STATUS flash_sfu(VOID *data, UINTN size)
+{
+	return flash_into_esp(data, size, L"BIOSUPDATE.fv");
+}
+
+static EFI_STATUS flash_ifwi(VOID *data, UINTN size)
+{
+	return flash_into_esp(data, size, L"ifwi.bin");
+}
+
+#define MBR_CODE_SIZE	440
+static EFI_STATUS flash_mbr(VOID *data, UINTN size)
+{
+	struct gpt_partition_interface gparti;
+	EFI_STATUS ret;
+
+	if (size > MBR_CODE_SIZE)
+		return EFI_INVALID_PARAMETER;
+
+	ret = gpt_get_root_disk(&gparti);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, "Failed to get disk information");
+		return ret;
+	}
+
+	ret = disk_write(&gparti, 0, size, data);
+	if (EFI_ERROR(ret))
+		efi_perror(ret, "Failed to flash MBR");
+
+	return ret;
+}
+
+/* The kernel is replaced in place.  Only the header is read, plus the
+ * ramdisk and second stage when the page aligned kernel size changes
+ * and they have to move.  Nothing past them is written. */
+static EFI_STATUS flash_zimage(VOID *data, UINTN size)
+{
+	struct boot_img_hdr hdr, *header;
+	CHAR8 *tail = NULL;
+	UINT64 start, partlen;
+	UINTN old_kernel, new_kernel, tail_size;
+	EFI_STATUS ret;
+
+	ret = gpt_get_partition_by_label(L"boot", &gparti);
+	if (EFI_ERROR(ret)) {
+		error(L"Unable to get information on the boot partition");
+		return ret;
+	}
+
+	start = gparti.part.starting_lba * gparti.bio->Media->BlockSize;
+	partlen = (gparti.part.ending_lba + 1 - gparti.part.starting_lba)
+		* gparti.bio->Media->BlockSize;
+
+	ret = disk_read(&gparti, start, sizeof(hdr), &hdr);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to load the current bootimage");
+		return ret;
+	}
+
+	if (strncmpa((CHAR8 *)BOOT_MAGIC, hdr.magic, BOOT_MAGIC_SIZE)) {
+		error(L"boot partition does not contain a valid bootimage");
+		return EFI_UNSUPPORTED;
+	}
+
+	if (hdr.page_size < sizeof(hdr) || (hdr.page_size & (hdr.page_size - 1))) {
+		error(L"Invalid bootimage page size %d", hdr.page_size);
+		return EFI_UNSUPPORTED;
+	}
+
+	old_kernel = pagealign(&hdr, hdr.kernel_size);
+	new_kernel = pagealign(&hdr, size);
+	tail_size = pagealign(&hdr, hdr.ramdisk_size) + pagealign(&hdr, hdr.second_size);
+	if (hdr.page_size + new_kernel + tail_size > partlen) {
+		error(L"Kernel image is too large to fit in the boot partition");
+		return EFI_INVALID_PARAMETER;
+	}
+
+	header = storage_alloc(gparti.bio, hdr.page_size);
+	if (!header) {
+		error(L"Unable to allocate bootimage buffer");
+		return EFI_OUT_OF_RESOURCES;
+	}
+
+	ret = disk_read(&gparti, start, hdr.page_size, header);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to load the current bootimage");
+		goto out;
+	}
+	header->kernel_size = size;
+
+	if (new_kernel != old_kernel && tail_size) {
+		tail = storage_alloc(gparti.bio, tail_size);
+		if (!tail) {
+			ret = EFI_OUT_OF_RESOURCES;
+			goto out;
+		}
+		ret = disk_read(&gparti, start + hdr.page_size + old_kernel, tail_size, tail);
+		if (EFI_ERROR(ret)) {
+			efi_perror(ret, L"Failed to load the bootimage ramdisk");
+			goto out;
+		}
+	}
+
+	/* Flash the new kernel, and the moved sections if any */
+	cur_offset = start;
+	wc_setup();
+	verify_setup();
+	ret = flash_write(header, hdr.page_size);
+	if (!EFI_ERROR(ret))
+		ret = flash_write(data, size);
+	if (!EFI_ERROR(ret) && new_kernel > size)
+		ret = flash_fill(0, new_kernel - size);
+	if (!EFI_ERROR(ret) && tail)
+		ret = flash_write(tail, tail_size);
+	if (!EFI_ERROR(ret))
+		ret = flash_flush();
+	if (!EFI_ERROR(ret))
+		ret = verify_finish(FALSE);
+	if (!EFI_ERROR(ret))
+		fastboot_info("%ld KiB written", (cur_offset - start) / 1024);
+
+ out:
+	storage_free(tail, tail_size);
+	storage_free(header, hdr.page_size);
+	return ret;
+}
+
+static EFI_STATUS flash_package(struct sglist *sg);
+
+/* The labels with a FLASH_SG_FUNC handle the downloaded list
+ * themselves, the others need the image in a single buffer.  Only
+ * the labels with VERIFY set read back what they write. */
+static struct label_exception {
+	CHAR16 *name;
+	EFI_STATUS (*flash_func)(VOID *data, UINTN size);
+	EFI_STATUS (*flash_sg_func)(struct sglist *sg);
+	BOOLEAN verify;
+} LABEL_EXCEPTIONS[] = {
+	{ L"gpt", flash_gpt, NULL, FALSE },
+	{ L"efirun", flash_efirun, NULL, FALSE },
+	{ L"sfu", flash_sfu, NULL, FALSE },
+	{ L"ifwi", flash_ifwi, NULL, FALSE },
+	{ L"mbr", flash_mbr, NULL, FALSE },
+	{ L"oemvars", flash_oemvars, NULL, FALSE },
+	{ L"zimage", flash_zimage, NULL, TRUE },
+	{ L"package", NULL, flash_package, TRUE }
+};
+
+static struct label_exception *find_label_exception(CHAR16 *label)
+{
+	UINTN i;
+
+	for (i = 0; i < ARRAY_SIZE(LABEL_EXCEPTIONS); i++)
+		if (!StrCmp(LABEL_EXCEPTIONS[i].name, label))
+			return &LABEL_EXCEPTIONS[i];
+
+	return NULL;
+}
+
+static CHAR16 *esp = L"/ESP/";
+
+static BOOLEAN is_esp_label(CHAR16 *label)
+{
+	return !StrnCmp(esp, label, StrLen(esp));
+}
+
+static EFI_STATUS verify_supported(CHAR16 *label)
+{
+	struct label_exception *exception;
+
+	if (!verify)
+		return EFI_SUCCESS;
+
+	exception = find_label_exception(label);
+	if (exception ? exception->verify : !is_esp_label(label))
+		return EFI_SUCCESS;
+
+	error(L"Verify is not supported for %s", label);
+	return EFI_UNSUPPORTED;
+}
+
+static EFI_STATUS flash_buffer(struct label_exception *exception, CHAR16 *label,
+			       VOID *data, UINTN size)
+{
+	/* special case for writing inside esp partition */
+	if (!exception)
+		return flash_into_esp(data, size, &label[ARRAY_SIZE(esp)]);
+
+	return exception->flash_func(data, size);
+}
+
+static EFI_STATUS flash_stream_sglist(struct sglist *sg);
+
+EFI_STATUS flash(struct sglist *sg, CHAR16 *label)
+{
+	struct label_exception *exception;
+	VOID *data;
+	EFI_STATUS ret;
+
+	ret = verify_supported(label);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	exception = find_label_exception(label);
+	if (exception && exception->flash_sg_func)
+		return exception->flash_sg_func(sg);
+
+	if (exception || is_esp_label(label)) {
+		ret = sglist_flatten(sg, &data);
+		if (EFI_ERROR(ret))
+			return ret;
+
+		return flash_buffer(exception, label, data, sg->size);
+	}
+
+	ret = flash_stream_open(label);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	return flash_stream_sglist(sg);
+}
+
+/* Streaming flash: the image is written to the partition piece by
+ * piece while it is still being received.  Only plain partitions
+ * are supported, the special labels need the whole image at once.
+ *
+ * The image may be compressed, it is then decompressed on the fly
+ * and the resulting payload, raw or sparse, is written the same
+ * way. */
+#define ZSTD_MAGIC 0xFD2FB528
+
+static BOOLEAN stream_opened;
+static BOOLEAN stream_lz4;
+static BOOLEAN payload_started;
+static BOOLEAN payload_sparse;
+static struct io_stats stream_writes;
+static UINT64 payload_in;
+
+/* Flash journal: the progress of the flash is regularly committed to
+ * an EFI variable so that an interrupted flash can be resumed where
+ * it stopped, see flash_resume().  The disk writes are flushed before
+ * each commit.  Compressed images are not journaled, the decoder
+ * state cannot be restored.
+ *
+ * Commits are FLASH_JOURNAL_INTERVAL apart at least, and further apart
+ * on large partitions so that there are at most FLASH_JOURNAL_COMMITS
+ * of them, to spare the variable store and the disk flushes. */
+#define FLASH_JOURNAL_VAR L"FlashJournal"
+#define FLASH_JOURNAL_INTERVAL (64 * MiB)
+#define FLASH_JOURNAL_COMMITS 64
+
+struct flash_journal {
+	CHAR16 label[37];
+	CHAR8 digest[FLASH_DIGEST_LEN + 1];
+	BOOLEAN sparse;
+	BOOLEAN discard;
+	BOOLEAN diff;
+	UINT64 in_offset;	/* Image bytes written */
+	UINT64 out_offset;	/* From the start of the partition */
+	struct sparse_position sparse_pos;
+};
+
+static struct flash_journal journal;
+static BOOLEAN journal_enabled;
+static BOOLEAN journal_saved;
+static UINT64 journal_last;
+static UINT64 journal_interval;
+static CHAR8 next_digest[FLASH_DIGEST_LEN + 1];
+
+/* Set the SHA-256 of the image about to be flashed, recorded in the
+ * journal to identify it */
+void flash_set_digest(CHAR8 *digest)
+{
+	UINTN i;
+
+	ZeroMem(next_digest, sizeof(next_digest));
+	if (!digest)
+		return;
+
+	for (i = 0; i < FLASH_DIGEST_LEN && digest[i]; i++)
+		next_digest[i] = digest[i] >= 'A' && digest[i] <= 'F' ?
+			digest[i] + 'a' - 'A' : digest[i];
+}
+
+static void journal_clear(void)
+{
+	EFI_STATUS ret;
+
+	ret = set_efi_variable(&fastboot_guid, FLASH_JOURNAL_VAR, 0, NULL, TRUE, FALSE);
+	if (EFI_ERROR(ret) && ret != EFI_NOT_FOUND)
+		efi_perror(ret, L"Failed to clear the flash journal");
+}
+
+static EFI_STATUS journal_load(struct flash_journal *j)
+{
+	struct flash_journal *data;
+	UINTN size;
+	EFI_STATUS ret;
+
+	ret = get_efi_variable(&fastboot_guid, FLASH_JOURNAL_VAR, &size,
+			       (VOID **)&data, NULL);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	if (size != sizeof(*j)) {
+		FreePool(data);
+		return EFI_NOT_FOUND;
+	}
+
+	memcpy(j, data, sizeof(*j));
+	FreePool(data);
+	return EFI_SUCCESS;
+}
+
+static void journal_start(CHAR16 *label)
+{
+	journal_clear();
+	ZeroMem(&journal, sizeof(journal));
+	memcpy(journal.label, label,
+	       MIN(StrLen(label), ARRAY_SIZE(journal.label) - 1) * sizeof(CHAR16));
+	memcpy(journal.digest, next_digest, sizeof(journal.digest));
+	journal.discard = discard;
+	journal.diff = diff;
+	journal_enabled = TRUE;
+	journal_saved = FALSE;
+	journal_last = cur_offset;
+}
+
+static EFI_STATUS journal_commit(void)
+{
+	EFI_STATUS ret;
+
+	if (payload_sparse && !sparse_stream_get_position(&journal.sparse_pos))
+		return EFI_SUCCESS;
+
+	ret = flash_flush();
+	if (EFI_ERROR(ret))
+		return ret;
+
+	ret = discard_flush();
+	if (EFI_ERROR(ret))
+		return ret;
+
+	ret = uefi_call_wrapper(gparti.bio->FlushBlocks, 1, gparti.bio);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to flush the disk");
+		return ret;
+	}
+
+	journal.sparse = payload_sparse;
+	journal.in_offset = payload_in;
+	journal.out_offset = cur_offset - part_start;
+	journal_last = cur_offset;
+
+	ret = set_efi_variable(&fastboot_guid, FLASH_JOURNAL_VAR,
+			       sizeof(journal), &journal, TRUE, FALSE);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to save the flash journal, disabling it");
+		journal_enabled = FALSE;
+	} else
+		journal_saved = TRUE;
+
+	return EFI_SUCCESS;
+}
+
+EFI_STATUS flash_get_progress(CHAR16 **label, UINT64 *offset)
+{
+	struct flash_journal j;
+	EFI_STATUS ret;
+
+	ret = journal_load(&j);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	*label = StrDuplicate(j.label);
+	if (!*label)
+		return EFI_OUT_OF_RESOURCES;
+
+	*offset = j.in_offset;
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS stream_open(CHAR16 *label)
+{
+	EFI_STATUS ret;
+
+	if (is_esp_label(label) || find_label_exception(label))
+		return EFI_UNSUPPORTED;
+
+	ret = gpt_get_partition_by_label(label, &gparti);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, "Failed to get partition %s", label);
+		return ret;
+	}
+
+	cur_offset = gparti.part.starting_lba * gparti.bio->Media->BlockSize;
+	journal_interval = MAX((UINT64)FLASH_JOURNAL_INTERVAL,
+			       (part_end - part_start) / FLASH_JOURNAL_COMMITS);
+	wc_setup();
+	diff_setup();
+	verify_setup();
+	discard_len = 0;
+	stream_writes = stats.write;
+	stream_opened = FALSE;
+	stream_lz4 = FALSE;
+	payload_started = FALSE;
+	payload_sparse = FALSE;
+	payload_in = 0;
+	journal_enabled = FALSE;
+	journal_saved = FALSE;
+
+	return EFI_SUCCESS;
+}
+
+EFI_STATUS flash_stream_open(CHAR16 *label)
+{
+	EFI_STATUS ret;
+
+	ret = stream_open(label);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	journal_start(label);
+	memcpy(verify_digest, next_digest, sizeof(verify_digest));
+	return EFI_SUCCESS;
+}
+
+/* Resume an interrupted flash of LABEL, SG holds the rest of the
+ * image, starting at the offset given by flash_get_progress().  If
+ * the interrupted image was identified by its SHA-256, DIGEST must be
+ * the same. */
+EFI_STATUS flash_resume(struct sglist *sg, CHAR16 *label, CHAR8 *digest)
+{
+	EFI_STATUS ret;
+
+	ret = journal_load(&journal);
+	if (EFI_ERROR(ret) || StrCmp(journal.label, label)) {
+		error(L"No interrupted flash of %s to resume", label);
+		return EFI_NOT_FOUND;
+	}
+
+	flash_set_digest(digest);
+	if (journal.digest[0] && !digest) {
+		error(L"The SHA-256 of the interrupted flash of %s is required", label);
+		return EFI_INVALID_PARAMETER;
+	}
+	if (journal.digest[0] &&
+	    memcmp(journal.digest, next_digest, FLASH_DIGEST_LEN)) {
+		error(L"The interrupted flash of %s was a different image", label);
+		return EFI_INVALID_PARAMETER;
+	}
+
+	diff = journal.diff;
+	ret = stream_open(label);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	debug(L"Resuming %s at image offset %ld, disk offset %ld",
+	      label, journal.in_offset, journal.out_offset);
+	cur_offset += journal.out_offset;
+	discard = journal.discard;
+	stream_opened = TRUE;
+	payload_started = TRUE;
+	payload_sparse = journal.sparse;
+	if (payload_sparse)
+		sparse_stream_resume(&journal.sparse_pos);
+	payload_in = journal.in_offset;
+	journal_enabled = TRUE;
+	journal_saved = TRUE;
+	journal_last = cur_offset;
+
+	return flash_stream_sglist(sg);
+}
+
+static EFI_STATUS flash_payload_write(VOID *data, UINTN size)
+{
+	EFI_STATUS ret;
+
+	if (!payload_started) {
+		payload_sparse = is_sparse_image(data, size);
+		if (payload_sparse)
+			sparse_stream_init();
+		payload_started = TRUE;
+	}
+
+	if (payload_sparse)
+		ret = sparse_stream_write(data, size);
+	else
+		ret = flash_write(data, size);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	payload_in += size;
+	if (journal_enabled && !stream_lz4 &&
+	    cur_offset - journal_last >= journal_interval)
+		return journal_commit();
+
+	return EFI_SUCCESS;
+}
+
+EFI_STATUS flash_stream_write(VOID *data, UINTN size)
+{
+	if (!stream_opened) {
+		if (size >= sizeof(UINT32) && *(UINT32 *)data == ZSTD_MAGIC) {
+			error(L"zstd compressed images are not supported");
+			return EFI_UNSUPPORTED;
+		}
+		stream_lz4 = is_lz4_image(data, size);
+		if (stream_lz4)
+			lz4_stream_init(flash_payload_write);
+		stream_opened = TRUE;
+	}
+
+	if (stream_lz4)
+		return lz4_stream_write(data, size);
 
-	return (EFI_SUCCESS | REFRESH_PARTITION_VAR);
+	return flash_payload_write(data, size);
 }
 
-/***
-static EFI_STATUS flash_keystore(VOID *data, UINTN size)
+/* Complete the stream, the partition table is not read again */
+static EFI_STATUS stream_close(void)
 {
 	EFI_STATUS ret;
+	UINT32 count;
 
-	if (size) {
-		struct keystore *ks = get_keystore(data, size);
+	if (stream_lz4) {
+		ret = lz4_stream_end();
+		if (EFI_ERROR(ret))
+			return ret;
+	}
 
-		if (!ks) {
-			error(L"keystore data is invalid");
-			return EFI_INVALID_PARAMETER;
-		}
+	if (payload_sparse) {
+		ret = sparse_stream_end();
+		if (EFI_ERROR(ret))
+			return ret;
+	}
 
-		free_keystore(ks);
+	ret = flash_flush();
+	if (EFI_ERROR(ret))
+		return ret;
+
+	ret = verify_finish(!stream_lz4 && !payload_sparse);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	/* Whatever follows the image is stale as well */
+	if (discard) {
+		ret = flash_skip(part_end - cur_offset);
+		if (EFI_ERROR(ret))
+			return ret;
+		ret = discard_flush();
+		if (EFI_ERROR(ret))
+			return ret;
 	}
 
-	ret = set_efi_variable(&fastboot_guid, KEYSTORE_VAR,
-			       size, data, TRUE, FALSE);
-	if (ret)
-		efi_perror(ret, "Coudn't modify KeyStore");
+	if (journal_saved)
+		journal_clear();
 
-	return ret;
+	count = stats.write.count - stream_writes.count;
+	if (count)
+		fastboot_info("%d writes, %ld KiB average",
+			      count, (stats.write.bytes - stream_writes.bytes) / count / 1024);
+	if (diff && diff_buffer)
+		fastboot_info("%ld KiB unchanged, %ld KiB written",
+			      diff_same / 1024, diff_written / 1024);
+
+	return EFI_SUCCESS;
 }
-***/
 
-static EFI_STATUS flash_efirun(VOID *data, UINTN size)
+EFI_STATUS flash_stream_close(void)
 {
-	return fastboot_usb_stop(NULL, data, size, UNKNOWN_TARGET);
+	EFI_STATUS ret;
+
+	ret = stream_close();
+	if (EFI_ERROR(ret))
+		return ret;
+
+	if (!CompareGuid(&gparti.part.type, &EfiPartTypeSystemPartitionGuid))
+		return gpt_refresh();
+
+	return EFI_SUCCESS;
 }
 
-static EFI_STATUS flash_sfu(VOID *data, UINTN size)
+/* The extents are fed in journal interval pieces: a downloaded image
+ * usually is a single extent and the journal is only committed
+ * between two writes. */
+static EFI_STATUS flash_stream_sglist(struct sglist *sg)
 {
-	return flash_into_esp(data, size, L"BIOSUPDATE.fv");
+	EFI_STATUS ret;
+	CHAR8 *data;
+	UINTN i, size, len;
+
+	for (i = 0; i < sg->count; i++) {
+		data = sg->entries[i].data;
+		for (size = sg->entries[i].size; size; size -= len) {
+			len = MIN(size, journal_interval);
+			ret = flash_stream_write(data, len);
+			if (EFI_ERROR(ret))
+				return ret;
+			data += len;
+		}
+	}
+
+	return flash_stream_close();
 }
 
-static EFI_STATUS flash_ifwi(VOID *data, UINTN size)
+/* Package: the images are checked against their SHA-256 before
+ * anything is written, then flashed in order.  The partition table
+ * is read again once, at the end. */
+static SHA256_CTX package_sha;
+
+static EFI_STATUS package_hash(VOID *data, UINTN size)
 {
-	return flash_into_esp(data, size, L"ifwi.bin");
+	SHA256_Update(&package_sha, data, size);
+	return EFI_SUCCESS;
 }
 
-#define MBR_CODE_SIZE	440
-static EFI_STATUS flash_mbr(VOID *data, UINTN size)
+static EFI_STATUS package_get_entry(struct sglist *sg, struct package_header *hdr,
+				    UINT32 index, struct package_entry *entry)
 {
-	struct gpt_partition_interface gparti;
 	EFI_STATUS ret;
 
-	if (size > MBR_CODE_SIZE)
-		return EFI_INVALID_PARAMETER;
-
-	ret = gpt_get_root_disk(&gparti);
+	ret = sglist_copy(sg, sizeof(*hdr) + (UINT64)index * hdr->entry_size,
+			  entry, sizeof(*entry));
 	if (EFI_ERROR(ret)) {
-		efi_perror(ret, "Failed to get disk information");
+		error(L"Package entry %d is truncated", index);
 		return ret;
 	}
 
-	ret = uefi_call_wrapper(gparti.dio->WriteDisk, 5, gparti.dio,
-				gparti.bio->Media->MediaId, 0, size, data);
-	if (EFI_ERROR(ret))
-		efi_perror(ret, "Failed to flash MBR");
+	if (!entry->label[0] || entry->label[PACKAGE_LABEL_LEN - 1]) {
+		error(L"Package entry %d has an invalid label", index);
+		return EFI_INVALID_PARAMETER;
+	}
 
-	return ret;
+	if (entry->offset > sg->size || entry->size > sg->size - entry->offset) {
+		error(L"Package entry %a is out of the package", entry->label);
+		return EFI_INVALID_PARAMETER;
+	}
+
+	return EFI_SUCCESS;
 }
 
-static EFI_STATUS flash_zimage(VOID *data, UINTN size)
+static EFI_STATUS package_check_entry(struct sglist *sg, struct package_entry *entry)
 {
-	struct boot_img_hdr *bootimage, *new_bootimage;
-	VOID *new_cur, *cur;
-	UINTN new_size, partlen;
+	UINT8 hash[SHA256_DIGEST_LENGTH];
+	CHAR16 *label;
 	EFI_STATUS ret;
 
-	ret = gpt_get_partition_by_label(L"boot", &gparti);
-	if (EFI_ERROR(ret)) {
-		error(L"Unable to get information on the boot partition");
+	label = stra_to_str(entry->label);
+	if (!label)
+		return EFI_OUT_OF_RESOURCES;
+	ret = verify_supported(label);
+	FreePool(label);
+	if (EFI_ERROR(ret))
 		return ret;
-	}
 
-	partlen = (gparti.part.ending_lba + 1 - gparti.part.starting_lba)
-		* gparti.bio->Media->BlockSize;
-	bootimage = AllocatePool(partlen);
-	if (!bootimage) {
-		error(L"Unable to allocate bootimage buffer");
-		return EFI_OUT_OF_RESOURCES;
-	}
+	SHA256_Init(&package_sha);
+	ret = sglist_for_each(sg, entry->offset, entry->size, package_hash);
+	if (EFI_ERROR(ret))
+		return ret;
+	SHA256_Final(hash, &package_sha);
 
-	ret = uefi_call_wrapper(gparti.dio->ReadDisk, 5, gparti.dio,
-				gparti.bio->Media->MediaId,
-				gparti.part.starting_lba * gparti.bio->Media->BlockSize,
-				partlen, bootimage);
-	if (EFI_ERROR(ret)) {
-		efi_perror(ret, L"Failed to load the current bootimage");
-		goto out;
+	if (CompareMem(hash, entry->sha256, sizeof(hash))) {
+		error(L"Package entry %a SHA-256 mismatch", entry->label);
+		return EFI_SECURITY_VIOLATION;
 	}
 
-	if (strncmpa((CHAR8 *)BOOT_MAGIC, bootimage->magic, BOOT_MAGIC_SIZE)) {
-		error(L"boot partition does not contain a valid bootimage");
-		ret = EFI_UNSUPPORTED;
-		goto out;
-	}
+	return EFI_SUCCESS;
+}
 
-	new_size = bootimage_size(bootimage) - bootimage->kernel_size
-		+ pagealign(bootimage, size);
-	if (new_size > partlen) {
-		error(L"Kernel image is too large to fit in the boot partition");
-		ret = EFI_INVALID_PARAMETER;
-		goto out;
-	}
+static EFI_STATUS package_flash_entry(struct sglist *sg, struct package_entry *entry,
+				      CHAR16 *label)
+{
+	struct label_exception *exception;
+	VOID *data;
+	EFI_STATUS ret;
 
-	new_bootimage = AllocateZeroPool(new_size);
-	if (!new_bootimage) {
-		ret = EFI_OUT_OF_RESOURCES;
-		goto out;
+	exception = find_label_exception(label);
+	if (exception && exception->flash_sg_func) {
+		error(L"%s is not supported in a package", label);
+		return EFI_UNSUPPORTED;
 	}
 
-	/* Create the new bootimage. */
-	memcpy((VOID *)new_bootimage, bootimage, bootimage->page_size);
-
-	new_bootimage->kernel_size = size;
-	new_bootimage->kernel_addr = bootimage->kernel_addr;
-	new_cur = (VOID *)new_bootimage + bootimage->page_size;
-	memcpy(new_cur, data, size);
-
-	new_cur += pagealign(new_bootimage, size);
-	cur = (VOID *)bootimage + bootimage->page_size
-		+ pagealign(bootimage, bootimage->kernel_size);
-	memcpy(new_cur, cur, bootimage->ramdisk_size);
-
-	new_cur += pagealign(new_bootimage, new_bootimage->ramdisk_size);
-	cur += pagealign(bootimage, bootimage->ramdisk_size);
-	memcpy(new_cur, cur, bootimage->second_size);
+	if (exception || is_esp_label(label)) {
+		data = AllocatePool(entry->size);
+		if (!data)
+			return EFI_OUT_OF_RESOURCES;
+		ret = sglist_copy(sg, entry->offset, data, entry->size);
+		if (!EFI_ERROR(ret))
+			ret = flash_buffer(exception, label, data, entry->size);
+		FreePool(data);
+		return ret;
+	}
 
-	/* Flash new the bootimage. */
-	cur_offset = gparti.part.starting_lba * gparti.bio->Media->BlockSize;
-	ret = flash_write(new_bootimage, new_size);
+	/* Package members are not journaled, flash_resume() would
+	 * take the package for the partition image. */
+	ret = stream_open(label);
+	if (EFI_ERROR(ret))
+		return ret;
+	verify_set_digest(entry->sha256);
 
-	FreePool(new_bootimage);
+	ret = sglist_for_each(sg, entry->offset, entry->size, flash_stream_write);
+	if (EFI_ERROR(ret))
+		return ret;
 
- out:
-	FreePool(bootimage);
-	return ret;
+	return stream_close();
 }
 
-static struct label_exception {
-	CHAR16 *name;
-	EFI_STATUS (*flash_func)(VOID *data, UINTN size);
-} LABEL_EXCEPTIONS[] = {
-	{ L"gpt", flash_gpt },
-	{ L"efirun", flash_efirun },
-	{ L"sfu", flash_sfu },
-	{ L"ifwi", flash_ifwi },
-	{ L"mbr", flash_mbr },
-	{ L"oemvars", flash_oemvars },
-	{ L"zimage", flash_zimage }
-};
-
-EFI_STATUS flash(VOID *data, UINTN size, CHAR16 *label)
+static EFI_STATUS flash_package(struct sglist *sg)
 {
-	CHAR16 *esp = L"/ESP/";
-	UINTN i;
-	EFI_STATUS ret;
-
-	/* special case for writing inside esp partition */
-	if (!StrnCmp(esp, label, StrLen(esp)))
-		return flash_into_esp(data, size, &label[ARRAY_SIZE(esp)]);
+	struct package_header hdr;
+	struct package_entry entry;
+	CHAR16 *label;
+	UINTN flags = 0;
+	EFI_STATUS ret, refresh;
+	UINT32 i;
+
+	ret = sglist_copy(sg, 0, &hdr, sizeof(hdr));
+	if (EFI_ERROR(ret) || hdr.magic != PACKAGE_MAGIC) {
+		error(L"Invalid package header");
+		return EFI_INVALID_PARAMETER;
+	}
 
-	/* special cases */
-	for (i = 0; i < ARRAY_SIZE(LABEL_EXCEPTIONS); i++)
-		if (!StrCmp(LABEL_EXCEPTIONS[i].name, label))
-			return LABEL_EXCEPTIONS[i].flash_func(data, size);
+	if (hdr.version != PACKAGE_VERSION || hdr.entry_size < sizeof(entry)) {
+		error(L"Unsupported package version %d", hdr.version);
+		return EFI_UNSUPPORTED;
+	}
 
-	ret = gpt_get_partition_by_label(label, &gparti);
-	if (EFI_ERROR(ret)) {
-		efi_perror(ret, "Failed to get partition %s", label);
-		return ret;
+	for (i = 0; i < hdr.entry_count; i++) {
+		ret = package_get_entry(sg, &hdr, i, &entry);
+		if (!EFI_ERROR(ret))
+			ret = package_check_entry(sg, &entry);
+		if (EFI_ERROR(ret))
+			return ret;
 	}
 
-	cur_offset = gparti.part.starting_lba * gparti.bio->Media->BlockSize;
+	for (i = 0; i < hdr.entry_count; i++) {
+		ret = package_get_entry(sg, &hdr, i, &entry);
+		if (EFI_ERROR(ret))
+			break;
 
-	if (is_sparse_image(data, size))
-		ret = flash_sparse(data, size);
-	else
-		ret = flash_write(data, size);
+		label = stra_to_str(entry.label);
+		if (!label) {
+			ret = EFI_OUT_OF_RESOURCES;
+			break;
+		}
+
+		fastboot_info("%s: %ld KiB (%d/%d)", label, entry.size / 1024,
+			      i + 1, hdr.entry_count);
+		ret = package_flash_entry(sg, &entry, label);
+		if (EFI_ERROR(ret))
+			efi_perror(ret, L"Failed to flash %s", label);
+		FreePool(label);
+		if (EFI_ERROR(ret))
+			break;
+		flags |= ret;
+	}
 
+	/* Some partitions may have been written even on failure */
+	refresh = gpt_refresh();
 	if (EFI_ERROR(ret))
 		return ret;
+	if (EFI_ERROR(refresh))
+		return refresh;
 
-	if (!CompareGuid(&gparti.part.type, &EfiPartTypeSystemPartitionGuid))
-		return gpt_refresh();
-
-	return EFI_SUCCESS;
+	return EFI_SUCCESS | flags;
 }
 
 EFI_STATUS flash_file(EFI_HANDLE image, CHAR16 *filename, CHAR16 *label)
@@ -341,6 +1594,8 @@ EFI_STATUS flash_file(EFI_HANDLE image, CHAR16 *filename, CHAR16 *label)
 	EFI_FILE_IO_INTERFACE *io = NULL;
 	VOID *buffer = NULL;
 	UINTN size = 0;
+	struct sg_entry entry;
+	struct sglist sg;
 
 	ret = uefi_call_wrapper(BS->HandleProtocol, 3, image, &FileSystemProtocol, (void *)&io);
 	if (EFI_ERROR(ret)) {
@@ -354,7 +1609,8 @@ EFI_STATUS flash_file(EFI_HANDLE image, CHAR16 *filename, CHAR16 *label)
 		goto out;
 	}
 
-	ret = flash(buffer, size, label);
+	sglist_wrap(&sg, &entry, buffer, size);
+	ret = flash(&sg, label);
 	if (EFI_ERROR(ret)) {
 		efi_perror(ret, "Failed to flash file %s on partition %s", filename, label);
 		goto free_buffer;
@@ -367,14 +1623,17 @@ out:
 
 }
 
-#define SDIO_DFLT_TIMEOUT 3000
-#define CARD_ADDRESS (1 << 16)
-EFI_STATUS secure_erase(EFI_SD_HOST_IO_PROTOCOL *sdio, UINT64 start, UINT64 end, UINTN timeout)
+/* ERASE command arguments */
+#define MMC_ERASE_TRIM		0x00000001
+#define MMC_ERASE_SECURE	0x80000000
+
+static EFI_STATUS mmc_erase(EFI_SD_HOST_IO_PROTOCOL *sdio, UINT64 start, UINT64 end,
+			    UINT32 arg, UINTN timeout)
 {
 	CARD_STATUS status;
 	EFI_STATUS ret;
 
-	debug(L"Secure erase lba %ld -> %ld", start, end);
+	debug(L"Erase lba %ld -> %ld, argument 0x%x", start, end, arg);
 
 	ret = uefi_call_wrapper(sdio->SendCommand, 9, sdio, ERASE_GROUP_START, start, NoData, NULL, 0, ResponseR1, SDIO_DFLT_TIMEOUT, (UINT32 *) &status);
 	if (EFI_ERROR(ret)) {
@@ -388,9 +1647,9 @@ EFI_STATUS secure_erase(EFI_SD_HOST_IO_PROTOCOL *sdio, UINT64 start, UINT64 end,
 		return ret;
 	}
 
-	ret = uefi_call_wrapper(sdio->SendCommand, 9, sdio, ERASE, 0x80000000, NoData, NULL, 0, ResponseR1, timeout, (UINT32 *) &status);
+	ret = uefi_call_wrapper(sdio->SendCommand, 9, sdio, ERASE, arg, NoData, NULL, 0, ResponseR1, timeout, (UINT32 *) &status);
 	if (EFI_ERROR(ret)) {
-		efi_perror(ret, "Secure Erase Failed");
+		efi_perror(ret, "Erase Failed");
 		return ret;
 	}
 
@@ -402,16 +1661,22 @@ EFI_STATUS secure_erase(EFI_SD_HOST_IO_PROTOCOL *sdio, UINT64 start, UINT64 end,
 			return ret;
 		}
 	} while (!status.READY_FOR_DATA);
-	debug(L"Secure erase success");
+	debug(L"Erase success");
 	return ret;
 }
 
+/* The pattern buffer is only read, so that AIO_QUEUE_DEPTH writes
+ * of it can be in flight at once. */
 static EFI_STATUS fill_with(EFI_BLOCK_IO *bio, UINT64 start, UINT64 end,
 			    VOID *pattern, UINTN pattern_blocks)
 {
+	struct aio_request requests[AIO_QUEUE_DEPTH];
+	UINTN i, slot = 0;
 	UINT64 lba;
 	UINT64 size;
-	EFI_STATUS ret;
+	EFI_STATUS ret, status;
+
+	ZeroMem(requests, sizeof(requests));
 
 	debug(L"Fill lba %d -> %d", start, end);
 	for (lba = start; lba <= end; lba += pattern_blocks) {
@@ -420,143 +1685,240 @@ static EFI_STATUS fill_with(EFI_BLOCK_IO *bio, UINT64 start, UINT64 end,
 		else
 			size = pattern_blocks;
 
-		ret = uefi_call_wrapper(bio->WriteBlocks, 5, bio, bio->Media->MediaId, lba, bio->Media->BlockSize * size, pattern);
+		ret = aio_wait(&requests[slot]);
+		if (EFI_ERROR(ret)) {
+			efi_perror(ret, "Failed to erase blocks before %ld", lba);
+			goto exit;
+		}
+
+		ret = aio_write(&requests[slot], bio, NULL, lba * bio->Media->BlockSize,
+				bio->Media->BlockSize * size, pattern, &stats.write);
 		if (EFI_ERROR(ret)) {
 			efi_perror(ret, "Failed to erase block %ld", lba);
 			goto exit;
 		}
+		slot = (slot + 1) % AIO_QUEUE_DEPTH;
 	}
 	ret = EFI_SUCCESS;
 
  exit:
+	for (i = 0; i < AIO_QUEUE_DEPTH; i++) {
+		status = aio_wait(&requests[i]);
+		if (EFI_ERROR(status) && !EFI_ERROR(ret)) {
+			efi_perror(status, "Failed to erase blocks");
+			ret = status;
+		}
+	}
 	return ret;
 }
 
-/* It is faster to erase multiple block at once
- * 4096 * 512 => 2MB
- */
-#define N_BLOCK (4096)
+/* It is faster to erase multiple block at once */
 static EFI_STATUS fill_zero(EFI_BLOCK_IO *bio, UINT64 start, UINT64 end)
 {
-	EFI_STATUS ret;
 	VOID *emptyblock;
 
-	emptyblock = AllocateZeroPool(bio->Media->BlockSize * N_BLOCK);
+	emptyblock = fill_buffer_get(0);
 	if (!emptyblock)
 		return EFI_OUT_OF_RESOURCES;
 
-	ret = fill_with(bio, start, end, emptyblock, N_BLOCK);
-
-	FreePool(emptyblock);
-
-	return ret;
+	return fill_with(bio, start, end, emptyblock,
+			 FILL_BUFFER_SIZE / bio->Media->BlockSize);
 }
 
-static EFI_STATUS get_mmc_info(EFI_SD_HOST_IO_PROTOCOL *sdio, UINTN *erase_grp_size, UINTN *timeout)
+/* Zero-fill the parts of the [START, END] range which are not
+ * aligned on GRP blocks and narrow the range to the aligned part.
+ * EFI_UNSUPPORTED if there is no aligned part. */
+static EFI_STATUS fill_unaligned(EFI_BLOCK_IO *bio, UINT64 *start, UINT64 *end, UINTN grp)
 {
-	EXT_CSD *ext_csd;
-	void *rawbuffer;
-	UINTN offset;
-	UINT32 status;
+	UINT64 first, last;
 	EFI_STATUS ret;
 
-	/* ext_csd pointer must be aligned to a multiple of sdio->HostCapability.BoundarySize
-	 * allocate twice the needed size, and compute the offset to get an aligned buffer
-	 */
-	rawbuffer = AllocateZeroPool(2 * sdio->HostCapability.BoundarySize);
-	if (!rawbuffer)
-		return EFI_OUT_OF_RESOURCES;
+	first = (*start + grp - 1) / grp * grp;
+	last = (*end + 1) / grp * grp;
+	if (first >= last)
+		return EFI_UNSUPPORTED;
 
-	offset = (UINTN) rawbuffer & (sdio->HostCapability.BoundarySize - 1);
-	offset = sdio->HostCapability.BoundarySize - offset;
-	ext_csd = (EXT_CSD *) ((CHAR8 *)rawbuffer + offset);
+	if (first > *start) {
+		ret = fill_zero(bio, *start, first - 1);
+		if (EFI_ERROR(ret)) {
+			error(L"failed to fill with zeros");
+			return ret;
+		}
+	}
 
-	ret = uefi_call_wrapper(sdio->SendCommand, 9, sdio, SEND_EXT_CSD, CARD_ADDRESS, InData, (void *)ext_csd, sizeof(EXT_CSD), ResponseR1, SDIO_DFLT_TIMEOUT, &status);
-	if (EFI_ERROR(ret)) {
-		efi_perror(ret, "failed get ext_csd");
-		goto out;
+	if (last <= *end) {
+		ret = fill_zero(bio, last, *end);
+		if (EFI_ERROR(ret)) {
+			error(L"failed to fill with zeros");
+			return ret;
+		}
 	}
 
-	/* Erase group size is 512Kbyte × HC_ERASE_GRP_SIZE
-	 * so it's 1024 x HC_ERASE_GRP_SIZE in sector count
-	 * timeout is 300ms x ERASE_TIMEOUT_MULT per erase group*/
-	*erase_grp_size = 1024 * ext_csd->HC_ERASE_GRP_SIZE;
-	*timeout = 300 * ext_csd->ERASE_TIMEOUT_MULT;
+	*start = first;
+	*end = last - 1;
+	return EFI_SUCCESS;
+}
+
+/* Erase backends, tried in order until one of them handles the
+ * range.  They return EFI_UNSUPPORTED when the firmware, the device
+ * or the range does not allow them.  The eMMC DISCARD is not used:
+ * discarded blocks may still read back their previous content.
+ * TRIM and the plain erase are only used to drop content we are
+ * about to overwrite or skip, a user requested erase must not leave
+ * the old data on the flash chips. */
+static EFI_STATUS erase_with_protocol(EFI_BLOCK_IO *bio, UINT64 start, UINT64 end)
+{
+	EFI_ERASE_BLOCK_PROTOCOL *erase;
+	EFI_ERASE_BLOCK_TOKEN token;
+	EFI_STATUS ret;
+
+	ret = storage_get_erase_protocol(bio, &erase);
+	if (EFI_ERROR(ret))
+		return ret;
 
-	debug(L"eMMC parameter: erase grp size %d sectors, timeout %d ms", *erase_grp_size, *timeout);
+	if (erase->EraseLengthGranularity > 1) {
+		ret = fill_unaligned(bio, &start, &end, erase->EraseLengthGranularity);
+		if (EFI_ERROR(ret))
+			return ret;
+	}
 
-out:
-	FreePool(rawbuffer);
+	/* No event, the erase is blocking */
+	ZeroMem(&token, sizeof(token));
+	ret = uefi_call_wrapper(erase->EraseBlocks, 5, erase, bio->Media->MediaId,
+				start, &token, (end + 1 - start) * bio->Media->BlockSize);
+	if (EFI_ERROR(ret))
+		efi_perror(ret, "Erase block protocol failed");
 	return ret;
 }
 
-EFI_STATUS erase_blocks(EFI_BLOCK_IO *bio, UINT64 start, UINT64 end)
+static EFI_STATUS erase_with_trim(__attribute__((__unused__)) EFI_BLOCK_IO *bio,
+				  UINT64 start, UINT64 end)
 {
-	EFI_SD_HOST_IO_PROTOCOL *sdio;
+	const struct storage_geometry *geo;
+	UINTN groups;
 	EFI_STATUS ret;
-	UINTN erase_grp_size;
-	UINTN timeout;
-	UINT64 reminder;
-	/* UINT64 size; */
 
-	/* size in MB for debug */
-	/* size = (bio->Media->BlockSize * (end - start + 1)) / MiB; */
-	/* debug("Erasing partition start %ld end %ld Size %ld MB", start, end, size); */
+	ret = storage_get_geometry(&geo);
+	if (EFI_ERROR(ret) || !geo->has_trim || !geo->erase_grp_size)
+		return EFI_UNSUPPORTED;
 
-	/* check if we can use secure erase command */
-	ret = LibLocateProtocol(&gEfiSdHostIoProtocolGuid, (void **)&sdio);
-	if (EFI_ERROR(ret)) {
-		debug(L"failed to get sdio protocol, fallback to filling with zeros");
-		goto fallback;
-	}
-	ret = get_mmc_info(sdio, &erase_grp_size, &timeout);
-	if (EFI_ERROR(ret)) {
-		debug(L"failed to get mmc parameter, fallback to filling with zeros");
-		goto fallback;
-	}
-	if ((end - start + 1) < erase_grp_size)
-		goto fallback;
+	/* TRIM works on write blocks, the timeout is per erase group
+	 * touched */
+	groups = end / geo->erase_grp_size - start / geo->erase_grp_size + 1;
+	return mmc_erase(geo->sdio, start, end, MMC_ERASE_TRIM,
+			 geo->trim_timeout * groups);
+}
 
-	reminder = start % erase_grp_size;
-	if (reminder) {
-		ret = fill_zero(bio, start, start + erase_grp_size - reminder - 1);
-		if (EFI_ERROR(ret)) {
-			error(L"failed to fill with zeros");
-			return ret;
-		}
-		start += erase_grp_size - reminder;
+static EFI_STATUS mmc_erase_groups(EFI_BLOCK_IO *bio, UINT64 start, UINT64 end,
+				   BOOLEAN secure)
+{
+	const struct storage_geometry *geo;
+	EFI_STATUS ret;
+
+	ret = storage_get_geometry(&geo);
+	if (EFI_ERROR(ret) || !geo->erase_grp_size)
+		return EFI_UNSUPPORTED;
+	if (secure && !geo->has_secure_erase)
+		return EFI_UNSUPPORTED;
+
+	ret = fill_unaligned(bio, &start, &end, geo->erase_grp_size);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	return mmc_erase(geo->sdio, start, end, secure ? MMC_ERASE_SECURE : 0,
+			 geo->erase_timeout * ((end + 1 - start) / geo->erase_grp_size));
+}
+
+static EFI_STATUS erase_with_secure_erase(EFI_BLOCK_IO *bio, UINT64 start, UINT64 end)
+{
+	return mmc_erase_groups(bio, start, end, TRUE);
+}
+
+static EFI_STATUS erase_with_erase(EFI_BLOCK_IO *bio, UINT64 start, UINT64 end)
+{
+	return mmc_erase_groups(bio, start, end, FALSE);
+}
+
+static struct erase_backend {
+	const char *name;
+	EFI_STATUS (*erase)(EFI_BLOCK_IO *bio, UINT64 start, UINT64 end);
+	UINTN policies;
+} ERASE_BACKENDS[ERASE_BACKEND_COUNT] = {
+	/* Only for the secure policy, the firmware Erase Block protocol
+	 * does not tell whether the data is gone from the chips */
+	{ "emmc-secure-erase", erase_with_secure_erase, ERASE_SECURE },
+	{ "erase-block-protocol", erase_with_protocol, ERASE_SECURE | ERASE_DISCARD },
+	/* Erased eMMC blocks may read back as zeros, see erase_blocks() */
+	{ "emmc-trim", erase_with_trim, ERASE_DISCARD | ERASE_ZEROES },
+	{ "emmc-erase", erase_with_erase, ERASE_DISCARD | ERASE_ZEROES },
+	{ "zero-fill", fill_zero, ERASE_SECURE | ERASE_DISCARD }
+};
+
+static UINTN last_erase_backend;
+
+const char *erase_backend_name(UINTN backend)
+{
+	return backend < ARRAY_SIZE(ERASE_BACKENDS) ? ERASE_BACKENDS[backend].name : NULL;
+}
+
+EFI_STATUS erase_blocks(EFI_BLOCK_IO *bio, UINT64 start, UINT64 end,
+			enum erase_policy policy)
+{
+	const struct storage_geometry *geo;
+	EFI_STATUS ret = EFI_UNSUPPORTED;
+	UINT64 erase_start, bytes;
+	UINTN i;
+
+	/* The erased content of an eMMC is given by ERASED_MEM_CONT,
+	 * the other backends do not tell */
+	if (policy == ERASE_ZEROES) {
+		ret = storage_get_geometry(&geo);
+		if (EFI_ERROR(ret) || geo->erased_mem_cont)
+			return EFI_UNSUPPORTED;
 	}
 
-	reminder = (end + 1) % erase_grp_size;
-	if (reminder) {
-		ret = fill_zero(bio, end + 1 - reminder, end);
+	bytes = (end + 1 - start) * bio->Media->BlockSize;
+	for (i = 0; i < ARRAY_SIZE(ERASE_BACKENDS); i++) {
+		if (!(ERASE_BACKENDS[i].policies & policy))
+			continue;
+
+		erase_start = uefi_get_us();
+		ret = ERASE_BACKENDS[i].erase(bio, start, end);
+		if (ret == EFI_UNSUPPORTED)
+			continue;
 		if (EFI_ERROR(ret)) {
-			error(L"failed to fill with zeros");
-			return ret;
+			debug(L"%a failed, trying the next erase method", ERASE_BACKENDS[i].name);
+			continue;
 		}
-		end -= reminder;
+
+		stats_account(&stats.erase, bytes, erase_start);
+		stats_account(&stats.erase_backend[i], bytes, erase_start);
+		last_erase_backend = i;
+		break;
 	}
-	timeout = timeout * ((end + 1 - start) / erase_grp_size);
-	return secure_erase(sdio, start, end, timeout);
 
-fallback:
-	return fill_zero(bio, start, end);
+	return ret;
 }
 
 EFI_STATUS erase_by_label(CHAR16 *label)
 {
 	EFI_STATUS ret;
+	UINT64 start;
 
 	ret = gpt_get_partition_by_label(label, &gparti);
 	if (EFI_ERROR(ret)) {
 		efi_perror(ret, "Failed to get partition %s", label);
 		return ret;
 	}
-	ret = erase_blocks(gparti.bio, gparti.part.starting_lba, gparti.part.ending_lba);
+	start = uefi_get_ms();
+	ret = erase_blocks(gparti.bio, gparti.part.starting_lba, gparti.part.ending_lba,
+			   ERASE_SECURE);
 	if (EFI_ERROR(ret)) {
 		efi_perror(ret, "Failed to erase partition %s", label);
 		return ret;
 	}
+	fastboot_info("Erased with %a in %ld ms",
+		      erase_backend_name(last_erase_backend), uefi_get_ms() - start);
 	if (!CompareGuid(&gparti.part.type, &EfiPartTypeSystemPartitionGuid))
 		return gpt_refresh();
 
@@ -596,12 +1958,78 @@ static EFI_STATUS generate_random_number_chunk(VOID *chunk, UINTN size)
 	return EFI_SUCCESS;
 }
 
+/* The disk is overwritten with a ChaCha20 keystream, fresh for every
+ * stripe.  The key comes from the CPU random number generator when
+ * there is one.  The next stripe is generated while the previous one
+ * is being written. */
+#define GARBAGE_STRIPE (2 * MiB)
+#define GARBAGE_BUFFERS 2
+#define CPUID_RDRAND (1 << 30)		/* Leaf 1, ECX */
+#define CPUID_RDSEED (1 << 18)		/* Leaf 7, EBX */
+#define RDRAND_RETRIES 10
+
+static void cpuid(UINT32 leaf, UINT32 regs[4])
+{
+	asm volatile ("cpuid"
+		      : "=a" (regs[0]), "=b" (regs[1]), "=c" (regs[2]), "=d" (regs[3])
+		      : "a" (leaf), "c" (0));
+}
+
+static BOOLEAN cpu_random_word(BOOLEAN rdseed, UINTN *value)
+{
+	UINT8 ok;
+	UINTN i;
+
+	for (i = 0; i < RDRAND_RETRIES; i++) {
+		if (rdseed)
+			asm volatile ("rdseed %0; setc %1" : "=r" (*value), "=qm" (ok));
+		else
+			asm volatile ("rdrand %0; setc %1" : "=r" (*value), "=qm" (ok));
+		if (ok)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/* RDSEED, falling back to RDRAND when it runs out of entropy */
+static EFI_STATUS cpu_random(UINT8 *buf, UINTN size)
+{
+	UINT32 regs[4], max_leaf;
+	BOOLEAN rdseed = FALSE;
+	UINTN i, value;
+
+	cpuid(0, regs);
+	max_leaf = regs[0];
+	cpuid(1, regs);
+	if (!(regs[2] & CPUID_RDRAND))
+		return EFI_UNSUPPORTED;
+	if (max_leaf >= 7) {
+		cpuid(7, regs);
+		rdseed = !!(regs[1] & CPUID_RDSEED);
+	}
+
+	for (i = 0; i < size; i += sizeof(value)) {
+		if (!(rdseed && cpu_random_word(TRUE, &value)) &&
+		    !cpu_random_word(FALSE, &value))
+			return EFI_NOT_READY;
+		CopyMem(buf + i, &value, MIN(sizeof(value), size - i));
+	}
+
+	return EFI_SUCCESS;
+}
+
 EFI_STATUS garbage_disk(void)
 {
 	struct gpt_partition_interface gparti;
-	EFI_STATUS ret;
-	VOID *chunk;
-	UINTN size;
+	struct aio_request requests[GARBAGE_BUFFERS];
+	struct chacha20 ctx;
+	UINT8 key[CHACHA20_KEY_SIZE];
+	UINT8 nonce[CHACHA20_NONCE_SIZE];
+	CHAR8 *buffers, *buf;
+	UINT64 start, offset, end, start_us, ms, rate;
+	UINTN len, slot = 0, i, percent = 10;
+	EFI_STATUS ret, status;
 
 	ret = gpt_get_root_disk(&gparti);
 	if (EFI_ERROR(ret)) {
@@ -609,22 +2037,67 @@ EFI_STATUS garbage_disk(void)
 		return ret;
 	}
 
-	size = gparti.bio->Media->BlockSize * N_BLOCK;
-	chunk = AllocatePool(size);
-	if (!chunk) {
-		error(L"Unable to allocate the garbage chunk");
+	ret = cpu_random(key, sizeof(key));
+	if (EFI_ERROR(ret)) {
+		debug(L"No CPU random number generator, using OpenSSL");
+		ret = generate_random_number_chunk(key, sizeof(key));
+		if (EFI_ERROR(ret))
+			return ret;
+	}
+	/* The key is never reused, the nonce does not matter */
+	ZeroMem(nonce, sizeof(nonce));
+	chacha20_init(&ctx, key, nonce, 0);
+	ZeroMem(key, sizeof(key));
+
+	buffers = storage_alloc(gparti.bio, GARBAGE_BUFFERS * GARBAGE_STRIPE);
+	if (!buffers) {
+		error(L"Unable to allocate the garbage buffers");
 		return EFI_OUT_OF_RESOURCES;
 	}
+	ZeroMem(requests, sizeof(requests));
+
+	start = gparti.part.starting_lba * gparti.bio->Media->BlockSize;
+	end = (gparti.part.ending_lba + 1) * gparti.bio->Media->BlockSize;
+	start_us = uefi_get_us();
+
+	for (offset = start; offset < end; offset += len) {
+		len = MIN(end - offset, GARBAGE_STRIPE);
+		buf = buffers + slot * GARBAGE_STRIPE;
+
+		ret = aio_wait(&requests[slot]);
+		if (EFI_ERROR(ret))
+			break;
+
+		chacha20_keystream(&ctx, buf, len);
+		ret = aio_write(&requests[slot], gparti.bio, NULL, offset, len, buf,
+				&stats.write);
+		if (EFI_ERROR(ret))
+			break;
+		slot = (slot + 1) % GARBAGE_BUFFERS;
+
+		if ((offset + len - start) * 100 / (end - start) >= percent) {
+			fastboot_info("Garbage: %d%%", percent);
+			percent += 10;
+		}
+	}
 
-	ret = generate_random_number_chunk(chunk, size);
-	if (EFI_ERROR(ret)) {
-		FreePool(chunk);
-		return ret;
+	for (i = 0; i < GARBAGE_BUFFERS; i++) {
+		status = aio_wait(&requests[i]);
+		if (EFI_ERROR(status) && !EFI_ERROR(ret))
+			ret = status;
 	}
+	ZeroMem(&ctx, sizeof(ctx));
+	storage_free(buffers, GARBAGE_BUFFERS * GARBAGE_STRIPE);
 
-	ret = fill_with(gparti.bio, gparti.part.starting_lba,
-			gparti.part.ending_lba, chunk, N_BLOCK);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, "Failed to write garbage at offset %ld", offset);
+	} else {
+		ms = MAX((uefi_get_us() - start_us) / 1000, 1);
+		rate = (end - start) * 100 * 1000 / ms / MiB;
+		fastboot_info("%ld MiB in %ld ms, %ld.%02ld MiB/s", (end - start) / MiB,
+			      ms, rate / 100, rate % 100);
+	}
 
-	FreePool(chunk);
-	return gpt_refresh();
+	status = gpt_refresh();
+	return EFI_ERROR(ret) ? ret : status;
 }
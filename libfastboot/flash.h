@@ -36,17 +36,76 @@
 #define _FLASH_H_
 
 #include <efi.h>
+#include "sglist.h"
+#include "storage.h"
+
+#define ERASE_BACKEND_COUNT 5
+
+/* What the caller expects from erase_blocks() */
+enum erase_policy {
+	ERASE_SECURE = 1 << 0,	/* old content must not be recoverable */
+	ERASE_DISCARD = 1 << 1,	/* content is dropped, fastest method */
+	ERASE_ZEROES = 1 << 2	/* blocks must read back as zeros */
+};
+
+struct storage_stats {
+	struct io_stats write;
+	struct io_stats read;
+	struct io_stats erase;
+	struct io_stats erase_backend[ERASE_BACKEND_COUNT];
+	UINT64 skip_bytes;
+};
+
+const struct storage_stats *storage_get_stats(void);
+void storage_reset_stats(void);
+const char *erase_backend_name(UINTN backend);
 
 EFI_STATUS flash_skip(UINT64 size);
 EFI_STATUS flash_write(VOID *data, UINTN size);
-EFI_STATUS flash_fill(UINT32 pattern, UINTN size);
+EFI_STATUS flash_flush(void);
+EFI_STATUS flash_fill(UINT32 pattern, UINT64 size);
 
 /* return value for flash() function */
 
 #define REFRESH_PARTITION_VAR 0x1
 
-EFI_STATUS flash(VOID *data, UINTN size, CHAR16 *label);
+/* Length of the hexadecimal SHA-256 digests identifying images */
+#define FLASH_DIGEST_LEN 64
+
+/* Multi-partition package, flashed with "flash:package".  The header
+ * is followed by ENTRY_COUNT entries of ENTRY_SIZE bytes, each one
+ * locating an image in the package and giving its SHA-256. */
+#define PACKAGE_MAGIC 0x4b504246	/* "FBPK" */
+#define PACKAGE_VERSION 1
+#define PACKAGE_LABEL_LEN 36
+
+struct package_header {
+	UINT32 magic;
+	UINT32 version;
+	UINT32 entry_count;
+	UINT32 entry_size;
+} __attribute__((packed));
+
+struct package_entry {
+	CHAR8 label[PACKAGE_LABEL_LEN];	/* NUL terminated */
+	UINT64 offset;			/* From the start of the package */
+	UINT64 size;
+	UINT8 sha256[32];
+} __attribute__((packed));
+
+void flash_set_discard(BOOLEAN enabled);
+void flash_set_digest(CHAR8 *digest);
+void flash_set_diff(BOOLEAN enabled);
+void flash_set_verify(BOOLEAN enabled);
+EFI_STATUS flash(struct sglist *sg, CHAR16 *label);
+EFI_STATUS flash_resume(struct sglist *sg, CHAR16 *label, CHAR8 *digest);
+EFI_STATUS flash_get_progress(CHAR16 **label, UINT64 *offset);
+EFI_STATUS flash_stream_open(CHAR16 *label);
+EFI_STATUS flash_stream_write(VOID *data, UINTN size);
+EFI_STATUS flash_stream_close(void);
 EFI_STATUS flash_file(EFI_HANDLE image, CHAR16 *filename, CHAR16 *label);
+EFI_STATUS erase_blocks(EFI_BLOCK_IO *bio, UINT64 start, UINT64 end,
+			enum erase_policy policy);
 EFI_STATUS erase_by_label(CHAR16 *label);
 EFI_STATUS garbage_disk(void);
 
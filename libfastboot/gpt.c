@@ -38,6 +38,7 @@
 #include "uefi_utils.h"
 #include "gpt.h"
 #include "gpt_bin.h"
+#include "crc32.h"
 
 #define PROTECTIVE_MBR 0xEE
 #define GPT_SIGNATURE "EFI PART"
@@ -109,12 +110,8 @@ static struct gpt_disk sdisk;
 
 static EFI_STATUS calculate_crc32(void *data, UINTN size, UINT32 *crc)
 {
-	EFI_STATUS ret;
-
-	ret = uefi_call_wrapper(BS->CalculateCrc32, 3, data, size, crc);
-	if (EFI_ERROR(ret))
-		efi_perror(ret, "CalculateCrc32 failed");
-	return ret;
+	*crc = crc32_update(0, data, size);
+	return EFI_SUCCESS;
 }
 
 static EFI_STATUS set_header_crc32(struct gpt_header *gh)
@@ -41,6 +41,8 @@
 #include "uefi_utils.h"
 #include "gpt.h"
 #include "android.h"
+#include "hashes.h"
+#include "storage.h"
 
 static void hash_buffer(CHAR8 *buffer, UINT64 len, CHAR8 *hash)
 {
@@ -110,7 +112,7 @@ EFI_STATUS get_boot_image_hash(CHAR16 *label)
 {
 	struct gpt_partition_interface gparti;
 	CHAR8 *data;
-	UINT64 len;
+	UINT64 len, imglen;
 	UINT64 offset;
 	CHAR8 hash[SHA_DIGEST_LENGTH];
 	EFI_STATUS ret;
@@ -128,24 +130,24 @@ EFI_STATUS get_boot_image_hash(CHAR16 *label)
 		error(L"partition too large to contain a boot image");
 		return EFI_INVALID_PARAMETER;
 	}
-	data = AllocatePool(len);
+	data = storage_alloc(gparti.bio, len);
 	if (!data) {
 		return EFI_OUT_OF_RESOURCES;
 	}
 
-	ret = uefi_call_wrapper(gparti.dio->ReadDisk, 5, gparti.dio, gparti.bio->Media->MediaId, offset, len, data);
+	ret = storage_read(gparti.bio, gparti.dio, offset, len, data, NULL);
 	if (EFI_ERROR(ret)) {
 		efi_perror(ret, "Failed to read partition");
-		FreePool(data);
+		storage_free(data, len);
 		return ret;
 	}
 
-	len = get_bootimage_len(data, len);
-	if (len) {
-		hash_buffer(data, len, hash);
+	imglen = get_bootimage_len(data, len);
+	if (imglen) {
+		hash_buffer(data, imglen, hash);
 		report_hash(L"/", label, hash);
 	}
-	FreePool(data);
+	storage_free(data, len);
 	return EFI_SUCCESS;
 }
 
@@ -373,39 +375,65 @@ static EFI_STATUS read_partition(struct gpt_partition_interface *gparti, UINT64
 		error(L"attempt to read outside of partition %s, (len %lld offset %lld partition len %lld)", gparti->part.name, len, offset, partlen);
 		return EFI_INVALID_PARAMETER;
 	}
-	ret = uefi_call_wrapper(gparti->dio->ReadDisk, 5, gparti->dio, gparti->bio->Media->MediaId, partoffset + offset, len, data);
+	ret = storage_read(gparti->bio, gparti->dio, partoffset + offset, len, data, NULL);
 	if (EFI_ERROR(ret))
 		efi_perror(ret, L"read partition %s failed", gparti->part.name);
 	return ret;
 }
 
 #define CHUNK 1024 * 1024
-#define MIN(a, b) ((a < b) ? (a) : (b))
+/* The next chunk is read asynchronously while the current one is
+ * hashed. */
 static EFI_STATUS hash_partition(struct gpt_partition_interface *gparti, UINT64 len, CHAR8 *hash)
 {
+	struct aio_request req;
 	SHA_CTX sha_ctx;
-	CHAR8 *buffer;
+	CHAR8 *buffers[2];
+	UINT64 partoffset;
 	UINT64 offset;
 	UINT64 chunklen;
+	UINTN cur = 0;
 	EFI_STATUS ret;
 
-	SHA1_Init(&sha_ctx);
+	partoffset = gparti->part.starting_lba * gparti->bio->Media->BlockSize;
+	if (len > (gparti->part.ending_lba + 1 - gparti->part.starting_lba) *
+	    gparti->bio->Media->BlockSize) {
+		error(L"attempt to hash outside of partition %s", gparti->part.name);
+		return EFI_INVALID_PARAMETER;
+	}
 
-	buffer = AllocatePool(CHUNK);
-	if (!buffer)
+	buffers[0] = storage_alloc(gparti->bio, 2 * CHUNK);
+	if (!buffers[0])
 		return EFI_OUT_OF_RESOURCES;
+	buffers[1] = buffers[0] + CHUNK;
+
+	SHA1_Init(&sha_ctx);
 
-	for (offset = 0; offset < len; offset += CHUNK) {
+	ret = aio_read(&req, gparti->bio, gparti->dio, partoffset,
+		       MIN(len, CHUNK), buffers[cur], NULL);
+	for (offset = 0; !EFI_ERROR(ret) && offset < len; offset += CHUNK) {
 		chunklen = MIN(len - offset, CHUNK);
-		ret = read_partition(gparti, offset, chunklen, buffer);
+		ret = aio_wait(&req);
 		if (EFI_ERROR(ret))
-			goto free;
-		SHA1_Update(&sha_ctx, buffer, chunklen);
+			break;
+		if (offset + CHUNK < len) {
+			ret = aio_read(&req, gparti->bio, gparti->dio,
+				       partoffset + offset + CHUNK,
+				       MIN(len - offset - CHUNK, CHUNK), buffers[!cur], NULL);
+			if (EFI_ERROR(ret))
+				break;
+		}
+		SHA1_Update(&sha_ctx, buffers[cur], chunklen);
+		cur = !cur;
 	}
-	SHA1_Final(hash, &sha_ctx);
+	aio_wait(&req);
 
-free:
-	FreePool(buffer);
+	if (EFI_ERROR(ret))
+		efi_perror(ret, L"read partition %s failed", gparti->part.name);
+	else
+		SHA1_Final(hash, &sha_ctx);
+
+	storage_free(buffers[0], 2 * CHUNK);
 	return ret;
 }
 
@@ -486,3 +514,65 @@ EFI_STATUS get_ext4_hash(CHAR16 *label)
 	report_hash(L"/", gparti.part.name, hash);
 	return EFI_SUCCESS;
 }
+
+/* Partition manifest: the SHA-256 of every stripe of the partition,
+ * after a struct partition_manifest header.  The host compares it
+ * with the image to flash and only sends the stripes which differ. */
+EFI_STATUS get_partition_manifest(CHAR16 *label, VOID **data, UINTN *size)
+{
+	struct gpt_partition_interface gparti;
+	struct partition_manifest *manifest;
+	SHA256_CTX sha_ctx;
+	CHAR8 *buffer, *hash;
+	UINT64 partlen, offset, chunklen;
+	EFI_STATUS ret;
+
+	ret = gpt_get_partition_by_label(label, &gparti);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, "Failed to get partition %s", label);
+		return ret;
+	}
+
+	partlen = (gparti.part.ending_lba + 1 - gparti.part.starting_lba) *
+		gparti.bio->Media->BlockSize;
+
+	*size = sizeof(*manifest) +
+		(partlen + MANIFEST_STRIPE - 1) / MANIFEST_STRIPE * SHA256_DIGEST_LENGTH;
+	manifest = AllocatePool(*size);
+	if (!manifest)
+		return EFI_OUT_OF_RESOURCES;
+
+	buffer = storage_alloc(gparti.bio, MANIFEST_STRIPE);
+	if (!buffer) {
+		FreePool(manifest);
+		return EFI_OUT_OF_RESOURCES;
+	}
+
+	manifest->magic = MANIFEST_MAGIC;
+	manifest->version = MANIFEST_VERSION;
+	manifest->stripe_size = MANIFEST_STRIPE;
+	manifest->hash_size = SHA256_DIGEST_LENGTH;
+	manifest->partition_size = partlen;
+	manifest->stripe_count = (partlen + MANIFEST_STRIPE - 1) / MANIFEST_STRIPE;
+
+	hash = (CHAR8 *)(manifest + 1);
+	for (offset = 0; offset < partlen; offset += MANIFEST_STRIPE) {
+		chunklen = MIN(partlen - offset, MANIFEST_STRIPE);
+		ret = read_partition(&gparti, offset, chunklen, buffer);
+		if (EFI_ERROR(ret))
+			break;
+		SHA256_Init(&sha_ctx);
+		SHA256_Update(&sha_ctx, buffer, chunklen);
+		SHA256_Final(hash, &sha_ctx);
+		hash += SHA256_DIGEST_LENGTH;
+	}
+
+	storage_free(buffer, MANIFEST_STRIPE);
+	if (EFI_ERROR(ret)) {
+		FreePool(manifest);
+		return ret;
+	}
+
+	*data = manifest;
+	return EFI_SUCCESS;
+}
@@ -39,4 +39,20 @@ EFI_STATUS get_boot_image_hash(CHAR16 *label);
 EFI_STATUS get_esp_hash(void);
 EFI_STATUS get_ext4_hash(CHAR16 *label);
 
+#define MANIFEST_MAGIC		0x464d4246	/* "FBMF" */
+#define MANIFEST_VERSION	1
+#define MANIFEST_STRIPE		(1024 * 1024)
+
+/* Followed by stripe_count hashes of hash_size bytes */
+struct partition_manifest {
+	UINT32 magic;
+	UINT32 version;
+	UINT32 stripe_size;
+	UINT32 hash_size;
+	UINT64 partition_size;
+	UINT64 stripe_count;
+} __attribute__((packed));
+
+EFI_STATUS get_partition_manifest(CHAR16 *label, VOID **data, UINTN *size);
+
 #endif	/* _HASHES_H_ */
@@ -0,0 +1,531 @@
+/*
+ * Copyright (c) 2026, agent
+ * All rights reserved.
+ *
+ * Authors: agent <agent@local>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <efi.h>
+#include <efilib.h>
+#include <lib.h>
+#include "uefi_utils.h"
+
+#include "lz4.h"
+
+/* LZ4 frame format decoder, see
+ * https://github.com/lz4/lz4/blob/dev/doc/lz4_Frame_format.md
+ *
+ * Like the sparse decoder, the frame can be fed in any number of
+ * buffers of any size.  Each decompressed block is passed to the
+ * output callback as soon as it is complete. */
+
+#define LZ4_MAGIC		0x184D2204
+#define LZ4_FLG_VERSION_MASK	0xC0
+#define LZ4_FLG_VERSION		0x40
+#define LZ4_FLG_BLOCK_INDEP	(1 << 5)
+#define LZ4_FLG_BLOCK_CHECKSUM	(1 << 4)
+#define LZ4_FLG_CONTENT_SIZE	(1 << 3)
+#define LZ4_FLG_CONTENT_CHECKSUM (1 << 2)
+#define LZ4_FLG_RESERVED	(1 << 1)
+#define LZ4_FLG_DICT_ID		(1 << 0)
+#define LZ4_BD_BLOCK_MAX(bd)	(((bd) >> 4) & 0x7)
+#define LZ4_BLOCK_RAW		0x80000000
+#define LZ4_HISTORY_SIZE	(64 * 1024)
+#define LZ4_MIN_MATCH		4
+#define LZ4_LAST_LITERALS	5
+
+/* Magic, FLG and BD come first, the optional fields follow */
+#define LZ4_HEADER_MIN		6
+#define LZ4_HEADER_MAX		(LZ4_HEADER_MIN + 8 + 4 + 1)
+
+#define PRIME32_1 0x9E3779B1U
+#define PRIME32_2 0x85EBCA77U
+#define PRIME32_3 0xC2B2AE3DU
+#define PRIME32_4 0x27D4EB2FU
+#define PRIME32_5 0x165667B1U
+
+struct xxh32 {
+	UINT32 v[4];
+	UINT64 total;
+	UINT8 mem[16];
+	UINTN memsize;
+};
+
+enum lz4_state {
+	LZ4_HEADER,
+	LZ4_HEADER_EXT,
+	LZ4_BLOCK_SIZE,
+	LZ4_BLOCK_DATA,
+	LZ4_CONTENT_CHECKSUM,
+	LZ4_DONE
+};
+
+static struct lz4_stream {
+	enum lz4_state state;
+	lz4_output_t output;
+	UINT8 flg;
+	UINTN block_max;
+	UINT64 content_size;
+	UINT64 decoded;
+	struct xxh32 xxh;
+	/* Current block size and the size to gather including its
+	 * checksum */
+	UINT32 block_size;
+	UINTN wanted;
+	/* Partial header, block size or checksum being gathered */
+	UINT8 hdr[LZ4_HEADER_MAX];
+	UINTN hdr_len;
+	UINTN hdr_wanted;
+	/* Compressed block being gathered */
+	UINT8 *in;
+	UINTN in_len;
+	/* Decompressed data, the last LZ4_HISTORY_SIZE bytes are kept
+	 * in front of it when blocks are linked. */
+	UINT8 *out;
+	UINTN history;
+} ls;
+
+static UINT32 le32(const UINT8 *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((UINT32)p[3] << 24);
+}
+
+static UINT32 rotl32(UINT32 x, int r)
+{
+	return (x << r) | (x >> (32 - r));
+}
+
+static UINT32 xxh32_round(UINT32 acc, UINT32 input)
+{
+	return rotl32(acc + input * PRIME32_2, 13) * PRIME32_1;
+}
+
+static void xxh32_init(struct xxh32 *x)
+{
+	ZeroMem(x, sizeof(*x));
+	x->v[0] = PRIME32_1 + PRIME32_2;
+	x->v[1] = PRIME32_2;
+	x->v[2] = 0;
+	x->v[3] = -PRIME32_1;
+}
+
+static void xxh32_update(struct xxh32 *x, const UINT8 *p, UINTN len)
+{
+	UINTN n, i;
+
+	x->total += len;
+
+	if (x->memsize) {
+		n = MIN(len, sizeof(x->mem) - x->memsize);
+		memcpy(x->mem + x->memsize, p, n);
+		x->memsize += n;
+		p += n;
+		len -= n;
+		if (x->memsize < sizeof(x->mem))
+			return;
+		for (i = 0; i < 4; i++)
+			x->v[i] = xxh32_round(x->v[i], le32(x->mem + i * 4));
+		x->memsize = 0;
+	}
+
+	for (; len >= sizeof(x->mem); p += sizeof(x->mem), len -= sizeof(x->mem))
+		for (i = 0; i < 4; i++)
+			x->v[i] = xxh32_round(x->v[i], le32(p + i * 4));
+
+	memcpy(x->mem, p, len);
+	x->memsize = len;
+}
+
+static UINT32 xxh32_digest(struct xxh32 *x)
+{
+	UINT8 *p = x->mem, *end = x->mem + x->memsize;
+	UINT32 h;
+
+	if (x->total >= sizeof(x->mem))
+		h = rotl32(x->v[0], 1) + rotl32(x->v[1], 7) +
+			rotl32(x->v[2], 12) + rotl32(x->v[3], 18);
+	else
+		h = x->v[2] + PRIME32_5;
+
+	h += (UINT32)x->total;
+
+	for (; p + 4 <= end; p += 4)
+		h = rotl32(h + le32(p) * PRIME32_3, 17) * PRIME32_4;
+	for (; p < end; p++)
+		h = rotl32(h + *p * PRIME32_5, 11) * PRIME32_1;
+
+	h ^= h >> 15;
+	h *= PRIME32_2;
+	h ^= h >> 13;
+	h *= PRIME32_3;
+	h ^= h >> 16;
+
+	return h;
+}
+
+static UINT32 xxh32(const UINT8 *p, UINTN len)
+{
+	struct xxh32 x;
+
+	xxh32_init(&x);
+	xxh32_update(&x, p, len);
+	return xxh32_digest(&x);
+}
+
+BOOLEAN is_lz4_image(void *data, UINT64 size)
+{
+	if (size < sizeof(UINT32))
+		return FALSE;
+
+	return le32(data) == LZ4_MAGIC;
+}
+
+/* Decompress the SIZE bytes LZ4 block at SRC to DST, which can hold
+ * CAPACITY bytes.  Matches may reach HISTORY bytes before DST. */
+static EFI_STATUS lz4_decompress_block(const UINT8 *src, UINTN size,
+				       UINT8 *dst, UINTN capacity,
+				       UINTN history, UINTN *decoded)
+{
+	const UINT8 *ip = src, *iend = src + size;
+	UINT8 *op = dst, *oend = dst + capacity;
+	UINT8 *match;
+	UINTN len, offset;
+	UINT8 token, b;
+
+	for (;;) {
+		if (ip >= iend)
+			goto malformed;
+		token = *ip++;
+
+		/* Literals */
+		len = token >> 4;
+		if (len == 15) {
+			do {
+				if (ip >= iend)
+					goto malformed;
+				b = *ip++;
+				len += b;
+			} while (b == 255);
+		}
+		if (len > (UINTN)(iend - ip) || len > (UINTN)(oend - op))
+			goto malformed;
+		memcpy(op, ip, len);
+		ip += len;
+		op += len;
+
+		/* The last sequence only has literals */
+		if (ip == iend)
+			break;
+
+		/* Match */
+		if (iend - ip < 2)
+			goto malformed;
+		offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (!offset || offset > (UINTN)(op - dst) + history)
+			goto malformed;
+
+		len = token & 0xF;
+		if (len == 15) {
+			do {
+				if (ip >= iend)
+					goto malformed;
+				b = *ip++;
+				len += b;
+			} while (b == 255);
+		}
+		len += LZ4_MIN_MATCH;
+		if (len > (UINTN)(oend - op))
+			goto malformed;
+
+		match = op - offset;
+		if (offset >= len) {
+			memcpy(op, match, len);
+			op += len;
+		} else {
+			/* Overlapping match, repeats the last OFFSET bytes */
+			while (len--)
+				*op++ = *match++;
+		}
+	}
+
+	*decoded = op - dst;
+	return EFI_SUCCESS;
+
+malformed:
+	error(L"Malformed LZ4 block at offset %d", ip - src);
+	return EFI_INVALID_PARAMETER;
+}
+
+/* Gather WANTED bytes in ls.hdr across calls, return TRUE once they
+ * are all available. */
+static BOOLEAN lz4_gather(CHAR8 **data, UINT64 *size, UINTN wanted)
+{
+	UINTN len = MIN(wanted - ls.hdr_len, *size);
+
+	memcpy(ls.hdr + ls.hdr_len, *data, len);
+	ls.hdr_len += len;
+	*data += len;
+	*size -= len;
+
+	return ls.hdr_len == wanted;
+}
+
+static EFI_STATUS lz4_header(void)
+{
+	UINT8 flg = ls.hdr[4], bd = ls.hdr[5];
+
+	if (le32(ls.hdr) != LZ4_MAGIC) {
+		error(L"Invalid LZ4 frame magic");
+		return EFI_INVALID_PARAMETER;
+	}
+	if ((flg & LZ4_FLG_VERSION_MASK) != LZ4_FLG_VERSION ||
+	    (flg & LZ4_FLG_RESERVED) || (bd & 0x8F)) {
+		error(L"Unsupported LZ4 frame descriptor %02x %02x", flg, bd);
+		return EFI_UNSUPPORTED;
+	}
+	if (flg & LZ4_FLG_DICT_ID) {
+		error(L"LZ4 frames using a dictionary are not supported");
+		return EFI_UNSUPPORTED;
+	}
+	if (LZ4_BD_BLOCK_MAX(bd) < 4) {
+		error(L"Invalid LZ4 block maximum size");
+		return EFI_INVALID_PARAMETER;
+	}
+
+	ls.flg = flg;
+	/* 64 KiB, 256 KiB, 1 MiB or 4 MiB */
+	ls.block_max = 1 << (8 + 2 * LZ4_BD_BLOCK_MAX(bd));
+	ls.hdr_wanted = LZ4_HEADER_MIN + 1;
+	if (flg & LZ4_FLG_CONTENT_SIZE)
+		ls.hdr_wanted += 8;
+	ls.state = LZ4_HEADER_EXT;
+
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS lz4_header_ext(void)
+{
+	UINT8 hc = ls.hdr[ls.hdr_wanted - 1];
+
+	if (((xxh32(ls.hdr + 4, ls.hdr_wanted - 5) >> 8) & 0xFF) != hc) {
+		error(L"LZ4 frame descriptor checksum mismatch");
+		return EFI_CRC_ERROR;
+	}
+
+	if (ls.flg & LZ4_FLG_CONTENT_SIZE)
+		ls.content_size = le32(ls.hdr + 6) | ((UINT64)le32(ls.hdr + 10) << 32);
+
+	ls.in = AllocatePool(ls.block_max + sizeof(UINT32));
+	ls.out = AllocatePool(LZ4_HISTORY_SIZE + ls.block_max);
+	if (!ls.in || !ls.out) {
+		error(L"Failed to allocate LZ4 buffers");
+		return EFI_OUT_OF_RESOURCES;
+	}
+
+	debug(L"LZ4 frame, %d bytes blocks, content size %ld",
+	      ls.block_max, ls.content_size);
+	xxh32_init(&ls.xxh);
+	ls.state = LZ4_BLOCK_SIZE;
+
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS lz4_block_size(void)
+{
+	UINT32 value = le32(ls.hdr);
+
+	if (!value) {
+		ls.state = ls.flg & LZ4_FLG_CONTENT_CHECKSUM ?
+			LZ4_CONTENT_CHECKSUM : LZ4_DONE;
+		return EFI_SUCCESS;
+	}
+
+	ls.block_size = value & ~LZ4_BLOCK_RAW;
+	if (ls.block_size > ls.block_max) {
+		error(L"LZ4 block too large, %d bytes", ls.block_size);
+		return EFI_INVALID_PARAMETER;
+	}
+
+	ls.wanted = ls.block_size;
+	if (ls.flg & LZ4_FLG_BLOCK_CHECKSUM)
+		ls.wanted += sizeof(UINT32);
+	ls.in_len = 0;
+	ls.state = LZ4_BLOCK_DATA;
+
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS lz4_block(UINT8 *block, BOOLEAN raw)
+{
+	UINT8 *dst;
+	UINTN len;
+	EFI_STATUS ret;
+
+	if ((ls.flg & LZ4_FLG_BLOCK_CHECKSUM) &&
+	    xxh32(block, ls.block_size) != le32(block + ls.block_size)) {
+		error(L"LZ4 block checksum mismatch");
+		return EFI_CRC_ERROR;
+	}
+
+	dst = ls.out + ls.history;
+	if (raw) {
+		memcpy(dst, block, ls.block_size);
+		len = ls.block_size;
+	} else {
+		ret = lz4_decompress_block(block, ls.block_size, dst,
+					   ls.block_max, ls.history, &len);
+		if (EFI_ERROR(ret))
+			return ret;
+	}
+
+	if (ls.flg & LZ4_FLG_CONTENT_CHECKSUM)
+		xxh32_update(&ls.xxh, dst, len);
+	ls.decoded += len;
+
+	ret = ls.output(dst, len);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	/* Linked blocks may refer to the previous 64 KiB of output */
+	if (!(ls.flg & LZ4_FLG_BLOCK_INDEP)) {
+		len += ls.history;
+		ls.history = MIN(len, LZ4_HISTORY_SIZE);
+		CopyMem(ls.out, ls.out + len - ls.history, ls.history);
+	}
+
+	ls.state = LZ4_BLOCK_SIZE;
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS lz4_block_data(CHAR8 **data, UINT64 *size)
+{
+	BOOLEAN raw = !!(le32(ls.hdr) & LZ4_BLOCK_RAW);
+	UINTN len;
+	EFI_STATUS ret;
+
+	/* Decode straight from the input buffer when the whole block
+	 * is there. */
+	if (!ls.in_len && *size >= ls.wanted) {
+		ret = lz4_block((UINT8 *)*data, raw);
+		*data += ls.wanted;
+		*size -= ls.wanted;
+		return ret;
+	}
+
+	len = MIN(ls.wanted - ls.in_len, *size);
+	memcpy(ls.in + ls.in_len, *data, len);
+	ls.in_len += len;
+	*data += len;
+	*size -= len;
+
+	if (ls.in_len < ls.wanted)
+		return EFI_SUCCESS;
+
+	return lz4_block(ls.in, raw);
+}
+
+static void lz4_free_buffers(void)
+{
+	if (ls.in)
+		FreePool(ls.in);
+	if (ls.out)
+		FreePool(ls.out);
+	ls.in = ls.out = NULL;
+}
+
+void lz4_stream_init(lz4_output_t output)
+{
+	lz4_free_buffers();
+	ZeroMem(&ls, sizeof(ls));
+	ls.output = output;
+	ls.state = LZ4_HEADER;
+}
+
+EFI_STATUS lz4_stream_write(void *data, UINT64 size)
+{
+	CHAR8 *s = data;
+	EFI_STATUS ret = EFI_SUCCESS;
+
+	while (size && !EFI_ERROR(ret)) {
+		switch (ls.state) {
+		case LZ4_HEADER:
+			if (lz4_gather(&s, &size, LZ4_HEADER_MIN))
+				ret = lz4_header();
+			break;
+		case LZ4_HEADER_EXT:
+			if (lz4_gather(&s, &size, ls.hdr_wanted)) {
+				ret = lz4_header_ext();
+				ls.hdr_len = 0;
+			}
+			break;
+		case LZ4_BLOCK_SIZE:
+			if (lz4_gather(&s, &size, sizeof(UINT32))) {
+				ret = lz4_block_size();
+				if (ls.state != LZ4_BLOCK_DATA)
+					ls.hdr_len = 0;
+			}
+			break;
+		case LZ4_BLOCK_DATA:
+			ret = lz4_block_data(&s, &size);
+			if (ls.state != LZ4_BLOCK_DATA)
+				ls.hdr_len = 0;
+			break;
+		case LZ4_CONTENT_CHECKSUM:
+			if (lz4_gather(&s, &size, sizeof(UINT32))) {
+				if (le32(ls.hdr) != xxh32_digest(&ls.xxh)) {
+					error(L"LZ4 content checksum mismatch");
+					ret = EFI_CRC_ERROR;
+				}
+				ls.state = LZ4_DONE;
+			}
+			break;
+		case LZ4_DONE:
+			debug(L"Ignoring %ld bytes after the LZ4 frame", size);
+			return EFI_SUCCESS;
+		}
+	}
+
+	return ret;
+}
+
+EFI_STATUS lz4_stream_end(void)
+{
+	EFI_STATUS ret = EFI_SUCCESS;
+
+	if (ls.state != LZ4_DONE) {
+		error(L"LZ4 frame truncated after %ld bytes", ls.decoded);
+		ret = EFI_INVALID_PARAMETER;
+	} else if ((ls.flg & LZ4_FLG_CONTENT_SIZE) && ls.decoded != ls.content_size) {
+		error(L"LZ4 content size mismatch, %ld/%ld", ls.decoded, ls.content_size);
+		ret = EFI_INVALID_PARAMETER;
+	}
+
+	lz4_free_buffers();
+	return ret;
+}
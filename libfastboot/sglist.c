@@ -0,0 +1,295 @@
+/*
+ * Copyright (c) 2026, agent
+ * All rights reserved.
+ *
+ * Authors: agent <agent@local>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <efi.h>
+#include <efilib.h>
+#include <lib.h>
+
+#include "uefi_utils.h"
+#include "sglist.h"
+
+/* Extents are first tried as large as the whole buffer and halved on
+ * each allocation failure, down to this size. */
+#define SG_MIN_EXTENT_PAGES EFI_SIZE_TO_PAGES(1024 * 1024)
+#define SG_ENTRIES_STEP 16
+#define SG_PAGES_TO_SIZE(pages) ((UINT64)(pages) << EFI_PAGE_SHIFT)
+
+/* Highest address the extents may use.  On 32-bit builds this keeps
+ * them below 4 GiB, 64-bit builds can use the whole memory. */
+#define SG_MAX_ADDRESS ((EFI_PHYSICAL_ADDRESS)(UINTN)-1)
+
+static void sglist_drop_flat(struct sglist *sg)
+{
+	if (sg->flat)
+		FreePool(sg->flat);
+	sg->flat = NULL;
+	sg->flat_size = 0;
+}
+
+static void sglist_set_size(struct sglist *sg, UINT64 size)
+{
+	UINTN i;
+
+	sg->size = size;
+	sg->count = 0;
+	for (i = 0; i < sg->nr_entries; i++) {
+		sg->entries[i].size = MIN(size, SG_PAGES_TO_SIZE(sg->entries[i].pages));
+		size -= sg->entries[i].size;
+		if (sg->entries[i].size)
+			sg->count = i + 1;
+	}
+}
+
+static EFI_STATUS sglist_add_extent(struct sglist *sg, VOID *data, UINTN pages)
+{
+	struct sg_entry *entries;
+
+	if (sg->nr_entries == sg->max_entries) {
+		entries = AllocatePool((sg->max_entries + SG_ENTRIES_STEP) * sizeof(*entries));
+		if (!entries)
+			return EFI_OUT_OF_RESOURCES;
+		if (sg->entries) {
+			CopyMem(entries, sg->entries, sg->nr_entries * sizeof(*entries));
+			FreePool(sg->entries);
+		}
+		sg->entries = entries;
+		sg->max_entries += SG_ENTRIES_STEP;
+	}
+
+	sg->entries[sg->nr_entries].data = data;
+	sg->entries[sg->nr_entries].size = 0;
+	sg->entries[sg->nr_entries].pages = pages;
+	sg->nr_entries++;
+	sg->capacity += SG_PAGES_TO_SIZE(pages);
+
+	return EFI_SUCCESS;
+}
+
+/* Make SG able to hold SIZE bytes.  The current extents are reused
+ * if they are large enough, otherwise they are replaced by new ones. */
+EFI_STATUS sglist_alloc(struct sglist *sg, UINT64 size)
+{
+	EFI_PHYSICAL_ADDRESS addr;
+	UINTN extent, pages;
+	UINT64 remaining;
+	EFI_STATUS ret;
+
+	sglist_drop_flat(sg);
+	if (sg->capacity >= size) {
+		sglist_set_size(sg, size);
+		return EFI_SUCCESS;
+	}
+
+	sglist_free(sg);
+
+	extent = EFI_SIZE_TO_PAGES(size);
+	for (remaining = size; remaining; ) {
+		pages = MIN(extent, EFI_SIZE_TO_PAGES(remaining));
+		addr = SG_MAX_ADDRESS;
+		ret = uefi_call_wrapper(BS->AllocatePages, 4, AllocateMaxAddress,
+					EfiLoaderData, pages, &addr);
+		if (EFI_ERROR(ret)) {
+			if (extent <= SG_MIN_EXTENT_PAGES)
+				goto err;
+			extent = MAX(extent / 2, SG_MIN_EXTENT_PAGES);
+			continue;
+		}
+
+		ret = sglist_add_extent(sg, (VOID *)(UINTN)addr, pages);
+		if (EFI_ERROR(ret)) {
+			uefi_call_wrapper(BS->FreePages, 2, addr, pages);
+			goto err;
+		}
+		remaining -= MIN(remaining, SG_PAGES_TO_SIZE(pages));
+	}
+
+	sglist_set_size(sg, size);
+	debug(L"Allocated %ld bytes in %d extents", size, sg->nr_entries);
+	return EFI_SUCCESS;
+
+err:
+	efi_perror(ret, "Failed to allocate %ld bytes, %ld missing", size, remaining);
+	sglist_free(sg);
+	return ret;
+}
+
+void sglist_free(struct sglist *sg)
+{
+	UINTN i;
+
+	sglist_drop_flat(sg);
+	for (i = 0; i < sg->nr_entries; i++)
+		if (sg->entries[i].pages)
+			uefi_call_wrapper(BS->FreePages, 2,
+					  (EFI_PHYSICAL_ADDRESS)(UINTN)sg->entries[i].data,
+					  sg->entries[i].pages);
+	if (sg->entries)
+		FreePool(sg->entries);
+	ZeroMem(sg, sizeof(*sg));
+}
+
+/* Describe an existing contiguous buffer as a one extent list.  The
+ * buffer stays owned by the caller. */
+void sglist_wrap(struct sglist *sg, struct sg_entry *entry,
+		 VOID *data, UINTN size)
+{
+	ZeroMem(sg, sizeof(*sg));
+	entry->data = data;
+	entry->size = size;
+	entry->pages = 0;
+	sg->entries = entry;
+	sg->count = sg->nr_entries = sg->max_entries = 1;
+	sg->capacity = sg->size = size;
+}
+
+/* Return the data as a single buffer.  Nothing is copied if the data
+ * fits in one extent, otherwise a contiguous copy is made which lives
+ * until the list is reallocated or freed. */
+EFI_STATUS sglist_flatten(struct sglist *sg, VOID **data)
+{
+	UINTN i;
+	CHAR8 *cur;
+
+	if (sg->count <= 1) {
+		*data = sg->count ? sg->entries[0].data : NULL;
+		return EFI_SUCCESS;
+	}
+
+	if (sg->flat && sg->flat_size == sg->size) {
+		*data = sg->flat;
+		return EFI_SUCCESS;
+	}
+
+	sglist_drop_flat(sg);
+	if (sg->size != (UINTN)sg->size)
+		return EFI_BAD_BUFFER_SIZE;
+
+	sg->flat = AllocatePool(sg->size);
+	if (!sg->flat) {
+		error(L"Failed to allocate a %ld bytes contiguous buffer", sg->size);
+		return EFI_OUT_OF_RESOURCES;
+	}
+
+	for (i = 0, cur = sg->flat; i < sg->count; cur += sg->entries[i].size, i++)
+		CopyMem(cur, sg->entries[i].data, sg->entries[i].size);
+
+	sg->flat_size = sg->size;
+	*data = sg->flat;
+	return EFI_SUCCESS;
+}
+
+/* Copy SIZE bytes starting at OFFSET in the list to DST */
+EFI_STATUS sglist_copy(struct sglist *sg, UINT64 offset,
+		       VOID *dst, UINTN size)
+{
+	UINTN i, len;
+	CHAR8 *d = dst;
+
+	if (offset > sg->size || size > sg->size - offset)
+		return EFI_INVALID_PARAMETER;
+
+	for (i = 0; i < sg->count && size; i++) {
+		if (offset >= sg->entries[i].size) {
+			offset -= sg->entries[i].size;
+			continue;
+		}
+		len = MIN(size, sg->entries[i].size - offset);
+		CopyMem(d, (CHAR8 *)sg->entries[i].data + offset, len);
+		d += len;
+		size -= len;
+		offset = 0;
+	}
+
+	return EFI_SUCCESS;
+}
+
+/* Call FUNC on each piece of the SIZE bytes starting at OFFSET in
+ * the list, without copying them */
+EFI_STATUS sglist_for_each(struct sglist *sg, UINT64 offset, UINT64 size,
+			   EFI_STATUS (*func)(VOID *data, UINTN size))
+{
+	EFI_STATUS ret;
+	UINTN i, len;
+
+	if (offset > sg->size || size > sg->size - offset)
+		return EFI_INVALID_PARAMETER;
+
+	for (i = 0; i < sg->count && size; i++) {
+		if (offset >= sg->entries[i].size) {
+			offset -= sg->entries[i].size;
+			continue;
+		}
+		len = MIN(size, sg->entries[i].size - offset);
+		ret = func((CHAR8 *)sg->entries[i].data + offset, len);
+		if (EFI_ERROR(ret))
+			return ret;
+		size -= len;
+		offset = 0;
+	}
+
+	return EFI_SUCCESS;
+}
+
+/* Sum of the free memory below SG_MAX_ADDRESS, in bytes */
+UINT64 sglist_free_memory(void)
+{
+	EFI_MEMORY_DESCRIPTOR *desc;
+	CHAR8 *map, *cur;
+	UINTN nr_entries, key, desc_size, i;
+	UINT32 desc_version;
+	EFI_PHYSICAL_ADDRESS start, end;
+	UINT64 total = 0;
+
+	map = (CHAR8 *)LibMemoryMap(&nr_entries, &key, &desc_size, &desc_version);
+	if (!map) {
+		error(L"Failed to get the memory map");
+		return 0;
+	}
+
+	for (i = 0, cur = map; i < nr_entries; i++, cur += desc_size) {
+		desc = (EFI_MEMORY_DESCRIPTOR *)cur;
+		if (desc->Type != EfiConventionalMemory)
+			continue;
+
+		start = desc->PhysicalStart;
+		end = start + SG_PAGES_TO_SIZE(desc->NumberOfPages);
+		if (start >= SG_MAX_ADDRESS)
+			continue;
+		if (end - 1 > SG_MAX_ADDRESS)
+			end = SG_MAX_ADDRESS + 1;
+
+		total += end - start;
+	}
+
+	FreePool(map);
+	return total;
+}
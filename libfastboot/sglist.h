@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2026, agent
+ * All rights reserved.
+ *
+ * Authors: agent <agent@local>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _SGLIST_H_
+#define _SGLIST_H_
+
+#include <efi.h>
+
+/* A buffer made of several page extents which are not contiguous in
+ * memory.  It lets large images be received without a single huge
+ * allocation. */
+struct sg_entry {
+	VOID *data;
+	UINTN size;		/* Bytes of data held in this extent */
+	UINTN pages;		/* Allocated pages, 0 if not owned */
+};
+
+struct sglist {
+	struct sg_entry *entries;
+	UINTN count;		/* Extents holding data */
+	UINTN nr_entries;	/* Allocated extents */
+	UINTN max_entries;	/* Size of the entries array */
+	UINT64 capacity;	/* Total size of the allocated extents */
+	UINT64 size;		/* Size of the data held */
+	VOID *flat;		/* Contiguous copy, see sglist_flatten() */
+	UINT64 flat_size;
+};
+
+EFI_STATUS sglist_alloc(struct sglist *sg, UINT64 size);
+void sglist_free(struct sglist *sg);
+void sglist_wrap(struct sglist *sg, struct sg_entry *entry,
+		 VOID *data, UINTN size);
+EFI_STATUS sglist_flatten(struct sglist *sg, VOID **data);
+EFI_STATUS sglist_copy(struct sglist *sg, UINT64 offset,
+		       VOID *dst, UINTN size);
+EFI_STATUS sglist_for_each(struct sglist *sg, UINT64 offset, UINT64 size,
+			   EFI_STATUS (*func)(VOID *data, UINTN size));
+UINT64 sglist_free_memory(void);
+
+#endif	/* _SGLIST_H_ */
@@ -38,7 +38,9 @@
 #include "uefi_utils.h"
 
 #include "flash.h"
+#include "crc32.h"
 #include "sparse_format.h"
+#include "sparse.h"
 
 BOOLEAN is_sparse_image(void *data, UINT64 size)
 {
@@ -67,60 +69,274 @@ BOOLEAN is_sparse_image(void *data, UINT64 size)
 	return TRUE;
 }
 
-static EFI_STATUS flash_chunk(struct sparse_header *sph, struct chunk_header *ckh, CHAR8 *data, unsigned int size)
+/* The sparse image is decoded incrementally: it can be fed in any
+ * number of buffers of any size, the header, chunk and partial data
+ * state is kept between calls. */
+enum sparse_state {
+	SPARSE_FILE_HEADER,
+	SPARSE_CHUNK_HEADER,
+	SPARSE_CHUNK_DATA,
+	SPARSE_DONE
+};
+
+static struct sparse_stream {
+	enum sparse_state state;
+	struct sparse_header sph;
+	struct chunk_header ckh;
+	UINT32 chunk;
+	/* Bytes left in the current chunk data */
+	UINT64 remaining;
+	/* Bytes to ignore, extra header fields of newer versions */
+	UINT64 skip;
+	/* CRC32 of the image data so far, "don't care" counted as
+	 * zeros, checked against the CRC32 chunks */
+	UINT32 crc;
+	/* Partial header or fill value being gathered */
+	union {
+		struct sparse_header sph;
+		struct chunk_header ckh;
+		UINT32 value;
+	} buf;
+	UINTN buf_len;
+} ss;
+
+/* Gather WANTED bytes in ss.buf across calls, return TRUE once they
+ * are all available. */
+static BOOLEAN sparse_gather(CHAR8 **data, UINT64 *size, UINTN wanted)
+{
+	UINTN len = wanted - ss.buf_len;
+
+	if (len > *size)
+		len = *size;
+
+	memcpy((CHAR8 *)&ss.buf + ss.buf_len, *data, len);
+	ss.buf_len += len;
+	*data += len;
+	*size -= len;
+
+	if (ss.buf_len < wanted)
+		return FALSE;
+
+	ss.buf_len = 0;
+	return TRUE;
+}
+
+static void sparse_next_chunk(void)
 {
+	ss.chunk++;
+	ss.state = ss.chunk == ss.sph.total_chunks ? SPARSE_DONE : SPARSE_CHUNK_HEADER;
+}
+
+static EFI_STATUS sparse_file_header(void)
+{
+	if (!is_sparse_image(&ss.buf.sph, sizeof(ss.buf.sph))) {
+		error(L"Invalid sparse header");
+		return EFI_INVALID_PARAMETER;
+	}
+
+	memcpy(&ss.sph, &ss.buf.sph, sizeof(ss.sph));
+	ss.skip = ss.sph.file_hdr_sz - sizeof(ss.sph);
+	ss.chunk = 0;
+	ss.state = ss.sph.total_chunks ? SPARSE_CHUNK_HEADER : SPARSE_DONE;
+
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS sparse_chunk_header(void)
+{
+	struct chunk_header *ckh = &ss.ckh;
+
+	memcpy(ckh, &ss.buf.ckh, sizeof(*ckh));
+	if (ckh->total_sz < ss.sph.chunk_hdr_sz) {
+		error(L"sparse chunk malformated, %d, %d", ckh->total_sz, ss.sph.chunk_hdr_sz);
+		return EFI_INVALID_PARAMETER;
+	}
+
+	ss.skip = ss.sph.chunk_hdr_sz - sizeof(*ckh);
+	ss.remaining = ckh->total_sz - ss.sph.chunk_hdr_sz;
+
 	switch (ckh->chunk_type) {
 	case CHUNK_TYPE_RAW:
-		if (size % sph->blk_sz || size != ckh->chunk_sz * sph->blk_sz) {
+		if (ss.remaining != (UINT64)ckh->chunk_sz * ss.sph.blk_sz) {
 			error(L"inconsistent raw chunk");
 			return EFI_INVALID_PARAMETER;
 		}
-		return flash_write(data, size);
-	case CHUNK_TYPE_DONT_CARE:
-		return flash_skip(ckh->chunk_sz * sph->blk_sz);
+		break;
 	case CHUNK_TYPE_FILL:
-		return flash_fill(*((UINT32 *) data), ckh->chunk_sz * sph->blk_sz);
 	case CHUNK_TYPE_CRC32:
-		debug(L"crc chunk not implemented yet %d", size);
+		if (ss.remaining != sizeof(UINT32)) {
+			error(L"inconsistent chunk %04x", ckh->chunk_type);
+			return EFI_INVALID_PARAMETER;
+		}
+		break;
+	case CHUNK_TYPE_DONT_CARE:
+		if (ss.remaining) {
+			error(L"inconsistent don't care chunk");
+			return EFI_INVALID_PARAMETER;
+		}
 		break;
 	default:
 		error(L"Unknow chunk type %04x", ckh->chunk_type);
 		return EFI_INVALID_PARAMETER;
 	}
+
+	ss.state = SPARSE_CHUNK_DATA;
 	return EFI_SUCCESS;
 }
 
-EFI_STATUS flash_sparse(void *data, UINT64 size)
+/* CRC32 of SIZE bytes filled with PATTERN */
+static UINT32 crc32_fill(UINT32 crc, UINT32 pattern, UINT64 size)
 {
-	struct sparse_header *sph;
-	CHAR8 *s;
-	UINT64 rlen;
-	unsigned int i;
+	UINT32 buf[64];
+	UINTN i, len;
+
+	if (!pattern)
+		return crc32_zeros(crc, size);
+
+	for (i = 0; i < ARRAY_SIZE(buf); i++)
+		buf[i] = pattern;
+
+	for (; size; size -= len) {
+		len = MIN(size, sizeof(buf));
+		crc = crc32_update(crc, buf, len);
+	}
+
+	return crc;
+}
+
+static EFI_STATUS sparse_chunk_data(CHAR8 **data, UINT64 *size)
+{
+	struct chunk_header *ckh = &ss.ckh;
+	UINT64 len;
 	EFI_STATUS ret;
 
-	rlen = size;
-	s = data;
-	sph = data;
-	s += sph->file_hdr_sz;
+	switch (ckh->chunk_type) {
+	case CHUNK_TYPE_RAW:
+		len = MIN(ss.remaining, *size);
+		ret = flash_write(*data, len);
+		if (EFI_ERROR(ret))
+			return ret;
+		ss.crc = crc32_update(ss.crc, *data, len);
+		*data += len;
+		*size -= len;
+		ss.remaining -= len;
+		if (ss.remaining)
+			return EFI_SUCCESS;
+		break;
+	case CHUNK_TYPE_DONT_CARE:
+		ret = flash_skip((UINT64)ckh->chunk_sz * ss.sph.blk_sz);
+		if (EFI_ERROR(ret))
+			return ret;
+		ss.crc = crc32_zeros(ss.crc, (UINT64)ckh->chunk_sz * ss.sph.blk_sz);
+		break;
+	case CHUNK_TYPE_FILL:
+		if (!sparse_gather(data, size, sizeof(ss.buf.value)))
+			return EFI_SUCCESS;
+		ret = flash_fill(ss.buf.value, (UINT64)ckh->chunk_sz * ss.sph.blk_sz);
+		if (EFI_ERROR(ret))
+			return ret;
+		ss.crc = crc32_fill(ss.crc, ss.buf.value,
+				    (UINT64)ckh->chunk_sz * ss.sph.blk_sz);
+		break;
+	case CHUNK_TYPE_CRC32:
+		if (!sparse_gather(data, size, sizeof(ss.buf.value)))
+			return EFI_SUCCESS;
+		if (ss.buf.value != ss.crc) {
+			error(L"sparse image CRC32 mismatch at chunk %d, 0x%08x != 0x%08x",
+			      ss.chunk, ss.crc, ss.buf.value);
+			return EFI_CRC_ERROR;
+		}
+		break;
+	}
 
-	for (i = 0; i < sph->total_chunks; i++) {
-		struct chunk_header *ckh;
-		ckh = (struct chunk_header *) s;
+	sparse_next_chunk();
+	return EFI_SUCCESS;
+}
 
-		if (rlen < sph->chunk_hdr_sz || rlen < ckh->total_sz) {
-			error(L"sparse chunk truncated, %ld, %ld", rlen, size);
-			return EFI_INVALID_PARAMETER;
+void sparse_stream_init(void)
+{
+	ZeroMem(&ss, sizeof(ss));
+	ss.state = SPARSE_FILE_HEADER;
+}
+
+EFI_STATUS sparse_stream_write(void *data, UINT64 size)
+{
+	CHAR8 *s = data;
+	UINT64 len;
+	EFI_STATUS ret = EFI_SUCCESS;
+
+	while (size && !EFI_ERROR(ret)) {
+		if (ss.skip) {
+			len = MIN(ss.skip, size);
+			ss.skip -= len;
+			s += len;
+			size -= len;
+			continue;
 		}
-		if (ckh->total_sz < sph->chunk_hdr_sz) {
-			error(L"sparse chunk malformated, %d, %d", ckh->total_sz, sph->chunk_hdr_sz);
-			return EFI_INVALID_PARAMETER;
+
+		switch (ss.state) {
+		case SPARSE_FILE_HEADER:
+			if (sparse_gather(&s, &size, sizeof(ss.buf.sph)))
+				ret = sparse_file_header();
+			break;
+		case SPARSE_CHUNK_HEADER:
+			if (sparse_gather(&s, &size, sizeof(ss.buf.ckh)))
+				ret = sparse_chunk_header();
+			break;
+		case SPARSE_CHUNK_DATA:
+			ret = sparse_chunk_data(&s, &size);
+			break;
+		case SPARSE_DONE:
+			debug(L"Ignoring %ld bytes after the last chunk", size);
+			return EFI_SUCCESS;
 		}
-		ret = flash_chunk(sph, ckh, s + sph->chunk_hdr_sz, ckh->total_sz - sph->chunk_hdr_sz);
-		if (EFI_ERROR(ret))
-			return ret;
+	}
+
+	/* Chunks without data are handled as soon as their header is
+	 * complete, not only when more data comes in. */
+	if (!EFI_ERROR(ret) && !ss.skip && ss.state == SPARSE_CHUNK_DATA
+	    && ss.ckh.chunk_type == CHUNK_TYPE_DONT_CARE)
+		ret = sparse_chunk_data(&s, &size);
+
+	return ret;
+}
 
-		s += ckh->total_sz;
-		rlen -= ckh->total_sz;
+/* The decoder state can be saved between two buffers unless a header
+ * or a fill value is partially gathered. */
+BOOLEAN sparse_stream_get_position(struct sparse_position *pos)
+{
+	if (ss.buf_len)
+		return FALSE;
+
+	pos->state = ss.state;
+	pos->chunk = ss.chunk;
+	pos->crc = ss.crc;
+	pos->remaining = ss.remaining;
+	pos->skip = ss.skip;
+	memcpy(&pos->sph, &ss.sph, sizeof(pos->sph));
+	memcpy(&pos->ckh, &ss.ckh, sizeof(pos->ckh));
+
+	return TRUE;
+}
+
+void sparse_stream_resume(const struct sparse_position *pos)
+{
+	sparse_stream_init();
+	ss.state = pos->state;
+	ss.chunk = pos->chunk;
+	ss.crc = pos->crc;
+	ss.remaining = pos->remaining;
+	ss.skip = pos->skip;
+	memcpy(&ss.sph, &pos->sph, sizeof(ss.sph));
+	memcpy(&ss.ckh, &pos->ckh, sizeof(ss.ckh));
+}
+
+EFI_STATUS sparse_stream_end(void)
+{
+	if (ss.state != SPARSE_DONE) {
+		error(L"sparse image truncated, chunk %d/%d", ss.chunk, ss.sph.total_chunks);
+		return EFI_INVALID_PARAMETER;
 	}
+
 	return EFI_SUCCESS;
 }
@@ -36,8 +36,27 @@
 #define _SPARSE_H_
 
 #include <efi.h>
+#include "sparse_format.h"
 
-int is_sparse_image(void *data, UINT64 size);
-EFI_STATUS flash_sparse(void *data, UINT64 size);
+BOOLEAN is_sparse_image(void *data, UINT64 size);
+
+void sparse_stream_init(void);
+EFI_STATUS sparse_stream_write(void *data, UINT64 size);
+EFI_STATUS sparse_stream_end(void);
+
+/* Decoder state between two buffers, saved to resume an interrupted
+ * flash */
+struct sparse_position {
+	UINT32 state;
+	UINT32 chunk;
+	UINT32 crc;
+	UINT64 remaining;
+	UINT64 skip;
+	struct sparse_header sph;
+	struct chunk_header ckh;
+};
+
+BOOLEAN sparse_stream_get_position(struct sparse_position *pos);
+void sparse_stream_resume(const struct sparse_position *pos);
 
 #endif	/* _SPARSE_H_ */
@@ -0,0 +1,390 @@
+/*
+ * Copyright (c) 2026, agent
+ * All rights reserved.
+ *
+ * Authors: agent <agent@local>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <efi.h>
+#include <efilib.h>
+#include <lib.h>
+#include "uefi_utils.h"
+
+#include "storage.h"
+#include "Mmc.h"
+
+EFI_GUID gEfiSdHostIoProtocolGuid = EFI_SD_HOST_IO_PROTOCOL_GUID;
+static EFI_GUID EraseBlockProtocolGuid = EFI_ERASE_BLOCK_PROTOCOL_GUID;
+static EFI_GUID BlockIo2ProtocolGuid = EFI_BLOCK_IO2_PROTOCOL_GUID;
+
+/* SEC_FEATURE_SUPPORT bits */
+#define SECURE_ER_EN	(1 << 0)
+#define SEC_GB_CL_EN	(1 << 4)
+
+/* EXT_CSD fields not described in Mmc.h */
+#define EXT_CSD_CACHE_SIZE 249
+
+static struct storage_geometry geometry;
+static EFI_STATUS geometry_status = EFI_NOT_READY;
+
+static EFI_STATUS read_ext_csd(EFI_SD_HOST_IO_PROTOCOL *sdio)
+{
+	EXT_CSD *ext_csd;
+	UINT8 *raw;
+	void *rawbuffer;
+	UINTN offset;
+	UINT32 status;
+	EFI_STATUS ret;
+
+	/* ext_csd pointer must be aligned to a multiple of sdio->HostCapability.BoundarySize
+	 * allocate twice the needed size, and compute the offset to get an aligned buffer
+	 */
+	rawbuffer = AllocateZeroPool(2 * sdio->HostCapability.BoundarySize);
+	if (!rawbuffer)
+		return EFI_OUT_OF_RESOURCES;
+
+	offset = (UINTN) rawbuffer & (sdio->HostCapability.BoundarySize - 1);
+	offset = sdio->HostCapability.BoundarySize - offset;
+	ext_csd = (EXT_CSD *) ((CHAR8 *)rawbuffer + offset);
+	raw = (UINT8 *)ext_csd;
+
+	ret = uefi_call_wrapper(sdio->SendCommand, 9, sdio, SEND_EXT_CSD, CARD_ADDRESS, InData, (void *)ext_csd, sizeof(EXT_CSD), ResponseR1, SDIO_DFLT_TIMEOUT, &status);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, "failed get ext_csd");
+		goto out;
+	}
+
+	/* Erase group size is 512Kbyte × HC_ERASE_GRP_SIZE
+	 * so it's 1024 x HC_ERASE_GRP_SIZE in sector count
+	 * timeout is 300ms x ERASE_TIMEOUT_MULT per erase group,
+	 * 300ms x TRIM_MULT for a TRIM
+	 * write protect group is HC_WP_GRP_SIZE erase groups */
+	geometry.sdio = sdio;
+	geometry.ext_csd_rev = ext_csd->EXT_CSD_REV;
+	geometry.sectors = ext_csd->SEC_COUNT[0] | ext_csd->SEC_COUNT[1] << 8 |
+		ext_csd->SEC_COUNT[2] << 16 | (UINT64)ext_csd->SEC_COUNT[3] << 24;
+	geometry.erase_grp_size = 1024 * ext_csd->HC_ERASE_GRP_SIZE;
+	geometry.erase_timeout = 300 * ext_csd->ERASE_TIMEOUT_MULT;
+	geometry.trim_timeout = 300 * ext_csd->TRIM_MULT;
+	geometry.wp_grp_size = geometry.erase_grp_size * ext_csd->HC_WP_GRP_SIZE;
+	geometry.has_secure_erase = !!(ext_csd->SEC_FEATURE_SUPPORT & SECURE_ER_EN);
+	geometry.has_trim = !!(ext_csd->SEC_FEATURE_SUPPORT & SEC_GB_CL_EN);
+	/* Erased blocks read back as 0x00, or as 0xFF if set */
+	geometry.erased_mem_cont = ext_csd->ERASED_MEM_CONT;
+	/* DISCARD came with eMMC 4.5, EXT_CSD revision 6 */
+	geometry.has_discard = geometry.has_trim && ext_csd->EXT_CSD_REV >= 6;
+	/* CACHE_SIZE is in KiB */
+	geometry.cache_size = (raw[EXT_CSD_CACHE_SIZE] |
+			       raw[EXT_CSD_CACHE_SIZE + 1] << 8 |
+			       raw[EXT_CSD_CACHE_SIZE + 2] << 16 |
+			       (UINT64)raw[EXT_CSD_CACHE_SIZE + 3] << 24) * 1024;
+
+	debug(L"eMMC parameter: erase grp size %d sectors, timeout %d ms",
+	      geometry.erase_grp_size, geometry.erase_timeout);
+
+out:
+	FreePool(rawbuffer);
+	return ret;
+}
+
+EFI_STATUS storage_get_geometry(const struct storage_geometry **geo)
+{
+	EFI_SD_HOST_IO_PROTOCOL *sdio;
+
+	if (geometry_status == EFI_NOT_READY) {
+		geometry_status = LibLocateProtocol(&gEfiSdHostIoProtocolGuid, (void **)&sdio);
+		if (EFI_ERROR(geometry_status)) {
+			debug(L"failed to get sdio protocol");
+			geometry_status = EFI_UNSUPPORTED;
+		} else
+			geometry_status = read_ext_csd(sdio);
+	}
+
+	if (EFI_ERROR(geometry_status))
+		return geometry_status;
+
+	*geo = &geometry;
+	return EFI_SUCCESS;
+}
+
+/* Find the protocol GUID installed on the same handle as BIO */
+static EFI_STATUS find_device_protocol(EFI_BLOCK_IO *bio, EFI_GUID *guid, VOID **interface)
+{
+	EFI_HANDLE *handles;
+	EFI_BLOCK_IO *handle_bio;
+	UINTN i, count;
+	EFI_STATUS ret;
+
+	ret = LibLocateHandle(ByProtocol, guid, NULL, &count, &handles);
+	if (EFI_ERROR(ret))
+		return EFI_UNSUPPORTED;
+
+	ret = EFI_UNSUPPORTED;
+	for (i = 0; i < count; i++) {
+		if (EFI_ERROR(uefi_call_wrapper(BS->HandleProtocol, 3, handles[i],
+						&BlockIoProtocol, (VOID *)&handle_bio)))
+			continue;
+		if (handle_bio != bio)
+			continue;
+		ret = uefi_call_wrapper(BS->HandleProtocol, 3, handles[i], guid, interface);
+		break;
+	}
+
+	FreePool(handles);
+	return EFI_ERROR(ret) ? EFI_UNSUPPORTED : EFI_SUCCESS;
+}
+
+static EFI_BLOCK_IO *erase_bio;
+static EFI_ERASE_BLOCK_PROTOCOL *erase_protocol;
+static EFI_STATUS erase_status;
+
+EFI_STATUS storage_get_erase_protocol(EFI_BLOCK_IO *bio, EFI_ERASE_BLOCK_PROTOCOL **erase)
+{
+	if (bio != erase_bio) {
+		erase_status = find_device_protocol(bio, &EraseBlockProtocolGuid,
+						    (VOID **)&erase_protocol);
+		erase_bio = bio;
+		if (EFI_ERROR(erase_status))
+			debug(L"No erase block protocol");
+	}
+
+	if (EFI_ERROR(erase_status))
+		return erase_status;
+
+	*erase = erase_protocol;
+	return EFI_SUCCESS;
+}
+
+/* Asynchronous I/O.  Block aligned requests are queued with the
+ * Block I/O 2 protocol when the firmware provides it, the others are
+ * done synchronously with the Disk I/O protocol. */
+static EFI_BLOCK_IO *aio_bio;
+static EFI_BLOCK_IO2_PROTOCOL *aio_bio2;
+static EFI_STATUS aio_lookup;
+
+static EFI_BLOCK_IO2_PROTOCOL *aio_get(EFI_BLOCK_IO *bio)
+{
+	if (bio != aio_bio) {
+		aio_lookup = find_device_protocol(bio, &BlockIo2ProtocolGuid,
+						  (VOID **)&aio_bio2);
+		aio_bio = bio;
+		if (EFI_ERROR(aio_lookup))
+			debug(L"No block io 2 protocol, synchronous I/O");
+	}
+
+	return EFI_ERROR(aio_lookup) ? NULL : aio_bio2;
+}
+
+BOOLEAN aio_available(EFI_BLOCK_IO *bio)
+{
+	return aio_get(bio) != NULL;
+}
+
+static void aio_account(struct aio_request *req)
+{
+	if (!req->stats)
+		return;
+
+	req->stats->count++;
+	req->stats->bytes += req->size;
+	req->stats->us += uefi_get_us() - req->start_us;
+}
+
+/* Transfers meeting these conditions go straight to the Block I/O
+ * protocols, without the bounce buffer of Disk I/O */
+static BOOLEAN is_aligned(EFI_BLOCK_IO *bio, UINT64 offset, UINTN size, VOID *data)
+{
+	UINT32 block_size = bio->Media->BlockSize;
+	UINT32 io_align = bio->Media->IoAlign;
+
+	return !(offset % block_size) && !(size % block_size) &&
+		(io_align <= 1 || !((UINTN)data % io_align));
+}
+
+static EFI_STATUS sync_io(BOOLEAN write, EFI_BLOCK_IO *bio, EFI_DISK_IO *dio,
+			  UINT64 offset, UINTN size, VOID *data)
+{
+	UINT32 block_size = bio->Media->BlockSize;
+
+	if (is_aligned(bio, offset, size, data)) {
+		if (write)
+			return uefi_call_wrapper(bio->WriteBlocks, 5, bio, bio->Media->MediaId,
+						 offset / block_size, size, data);
+		return uefi_call_wrapper(bio->ReadBlocks, 5, bio, bio->Media->MediaId,
+					 offset / block_size, size, data);
+	}
+
+	if (!dio)
+		return EFI_INVALID_PARAMETER;
+
+	if (write)
+		return uefi_call_wrapper(dio->WriteDisk, 5, dio, bio->Media->MediaId,
+					 offset, size, data);
+	return uefi_call_wrapper(dio->ReadDisk, 5, dio, bio->Media->MediaId,
+				 offset, size, data);
+}
+
+static EFI_STATUS aio_submit(struct aio_request *req, BOOLEAN write,
+			     EFI_BLOCK_IO *bio, EFI_DISK_IO *dio, UINT64 offset,
+			     UINTN size, VOID *data, struct io_stats *stats)
+{
+	EFI_BLOCK_IO2_PROTOCOL *bio2 = aio_get(bio);
+	UINT32 block_size = bio->Media->BlockSize;
+	EFI_STATUS ret;
+
+	ZeroMem(req, sizeof(*req));
+	req->start_us = uefi_get_us();
+	req->size = size;
+	req->stats = stats;
+
+	if (bio2 && is_aligned(bio, offset, size, data)) {
+		ret = uefi_call_wrapper(BS->CreateEvent, 5, 0, 0, NULL, NULL,
+					&req->token.Event);
+		if (!EFI_ERROR(ret)) {
+			if (write)
+				ret = uefi_call_wrapper(bio2->WriteBlocksEx, 6, bio2,
+							bio2->Media->MediaId, offset / block_size,
+							&req->token, size, data);
+			else
+				ret = uefi_call_wrapper(bio2->ReadBlocksEx, 6, bio2,
+							bio2->Media->MediaId, offset / block_size,
+							&req->token, size, data);
+			if (!EFI_ERROR(ret)) {
+				req->busy = TRUE;
+				return EFI_SUCCESS;
+			}
+			uefi_call_wrapper(BS->CloseEvent, 1, req->token.Event);
+		}
+		debug(L"Asynchronous I/O failed, %r", ret);
+	}
+
+	ret = sync_io(write, bio, dio, offset, size, data);
+	aio_account(req);
+	return ret;
+}
+
+EFI_STATUS aio_write(struct aio_request *req, EFI_BLOCK_IO *bio, EFI_DISK_IO *dio,
+		     UINT64 offset, UINTN size, VOID *data, struct io_stats *stats)
+{
+	return aio_submit(req, TRUE, bio, dio, offset, size, data, stats);
+}
+
+EFI_STATUS aio_read(struct aio_request *req, EFI_BLOCK_IO *bio, EFI_DISK_IO *dio,
+		    UINT64 offset, UINTN size, VOID *data, struct io_stats *stats)
+{
+	return aio_submit(req, FALSE, bio, dio, offset, size, data, stats);
+}
+
+EFI_STATUS aio_wait(struct aio_request *req)
+{
+	UINTN index;
+	EFI_STATUS ret;
+
+	if (!req->busy)
+		return EFI_SUCCESS;
+
+	ret = uefi_call_wrapper(BS->WaitForEvent, 3, 1, &req->token.Event, &index);
+	uefi_call_wrapper(BS->CloseEvent, 1, req->token.Event);
+	req->busy = FALSE;
+	if (EFI_ERROR(ret))
+		req->token.TransactionStatus = ret;
+
+	aio_account(req);
+	return req->token.TransactionStatus;
+}
+
+static EFI_STATUS storage_io(BOOLEAN write, EFI_BLOCK_IO *bio, EFI_DISK_IO *dio,
+			     UINT64 offset, UINTN size, VOID *data, struct io_stats *stats)
+{
+	struct aio_request req;
+	EFI_STATUS ret;
+
+	ZeroMem(&req, sizeof(req));
+	req.start_us = uefi_get_us();
+	req.size = size;
+	req.stats = stats;
+
+	ret = sync_io(write, bio, dio, offset, size, data);
+	aio_account(&req);
+	return ret;
+}
+
+EFI_STATUS storage_write(EFI_BLOCK_IO *bio, EFI_DISK_IO *dio, UINT64 offset,
+			 UINTN size, VOID *data, struct io_stats *stats)
+{
+	return storage_io(TRUE, bio, dio, offset, size, data, stats);
+}
+
+EFI_STATUS storage_read(EFI_BLOCK_IO *bio, EFI_DISK_IO *dio, UINT64 offset,
+			UINTN size, VOID *data, struct io_stats *stats)
+{
+	return storage_io(FALSE, bio, dio, offset, size, data, stats);
+}
+
+/* The pages allocated in excess to reach the alignment are given
+ * back right away, so that storage_free() only needs the size. */
+VOID *storage_alloc(EFI_BLOCK_IO *bio, UINTN size)
+{
+	EFI_PHYSICAL_ADDRESS addr, aligned;
+	UINTN align = EFI_PAGE_SIZE;
+	UINTN pages, extra, head;
+	EFI_STATUS ret;
+
+	if (bio) {
+		align = MAX(align, bio->Media->IoAlign);
+		align = MAX(align, bio->Media->BlockSize);
+	}
+
+	pages = EFI_SIZE_TO_PAGES(size);
+	extra = EFI_SIZE_TO_PAGES(align) - 1;
+	ret = uefi_call_wrapper(BS->AllocatePages, 4, AllocateAnyPages,
+				EfiLoaderData, pages + extra, &addr);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, "Failed to allocate %ld bytes I/O buffer", size);
+		return NULL;
+	}
+
+	aligned = addr + (align - addr % align) % align;
+	head = EFI_SIZE_TO_PAGES(aligned - addr);
+	if (head)
+		uefi_call_wrapper(BS->FreePages, 2, addr, head);
+	if (extra > head)
+		uefi_call_wrapper(BS->FreePages, 2, aligned + pages * EFI_PAGE_SIZE,
+				  extra - head);
+
+	return (VOID *)(UINTN)aligned;
+}
+
+void storage_free(VOID *buffer, UINTN size)
+{
+	if (!buffer)
+		return;
+
+	uefi_call_wrapper(BS->FreePages, 2, (EFI_PHYSICAL_ADDRESS)(UINTN)buffer,
+			  EFI_SIZE_TO_PAGES(size));
+}
@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2026, agent
+ * All rights reserved.
+ *
+ * Authors: agent <agent@local>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _STORAGE_H_
+#define _STORAGE_H_
+
+#include <efi.h>
+#include "SdHostIo.h"
+
+#define SDIO_DFLT_TIMEOUT 3000
+#define CARD_ADDRESS (1 << 16)
+
+/* eMMC geometry, read from the EXT_CSD register once per session */
+struct storage_geometry {
+	EFI_SD_HOST_IO_PROTOCOL *sdio;
+	UINT8 ext_csd_rev;
+	UINT64 sectors;			/* Device size in 512 bytes sectors */
+	UINTN erase_grp_size;		/* In sectors */
+	UINTN erase_timeout;		/* In ms, per erase group */
+	UINTN trim_timeout;		/* In ms, per erase group */
+	UINTN wp_grp_size;		/* In sectors */
+	BOOLEAN has_secure_erase;
+	BOOLEAN has_trim;
+	BOOLEAN has_discard;
+	UINT64 cache_size;		/* In bytes */
+	UINT8 erased_mem_cont;		/* 0: erased blocks read as zeros, 1: as ones */
+};
+
+/* EFI_ERASE_BLOCK_PROTOCOL, UEFI 2.6 */
+#define EFI_ERASE_BLOCK_PROTOCOL_GUID \
+	{ 0x95a9a93e, 0xa86e, 0x4926, { 0xaa, 0xef, 0x99, 0x18, 0xe7, 0x72, 0xd9, 0x87 } }
+
+typedef struct {
+	EFI_EVENT Event;
+	EFI_STATUS TransactionStatus;
+} EFI_ERASE_BLOCK_TOKEN;
+
+struct _EFI_ERASE_BLOCK_PROTOCOL;
+
+typedef EFI_STATUS (EFIAPI *EFI_BLOCK_ERASE) (
+	IN struct _EFI_ERASE_BLOCK_PROTOCOL *This,
+	IN UINT32 MediaId,
+	IN EFI_LBA LBA,
+	IN OUT EFI_ERASE_BLOCK_TOKEN *Token,
+	IN UINTN Size
+	);
+
+typedef struct _EFI_ERASE_BLOCK_PROTOCOL {
+	UINT64 Revision;
+	UINT32 EraseLengthGranularity;
+	EFI_BLOCK_ERASE EraseBlocks;
+} EFI_ERASE_BLOCK_PROTOCOL;
+
+#ifndef EFI_BLOCK_IO2_PROTOCOL_GUID
+/* EFI_BLOCK_IO2_PROTOCOL, UEFI 2.3.1 */
+#define EFI_BLOCK_IO2_PROTOCOL_GUID \
+	{ 0xa77b2472, 0xe282, 0x4e9f, { 0xa2, 0x45, 0xc2, 0xc0, 0xe2, 0x7b, 0xbc, 0xc1 } }
+
+typedef struct {
+	EFI_EVENT Event;
+	EFI_STATUS TransactionStatus;
+} EFI_BLOCK_IO2_TOKEN;
+
+struct _EFI_BLOCK_IO2_PROTOCOL;
+
+typedef EFI_STATUS (EFIAPI *EFI_BLOCK_RESET_EX) (
+	IN struct _EFI_BLOCK_IO2_PROTOCOL *This,
+	IN BOOLEAN ExtendedVerification
+	);
+
+typedef EFI_STATUS (EFIAPI *EFI_BLOCK_READ_EX) (
+	IN struct _EFI_BLOCK_IO2_PROTOCOL *This,
+	IN UINT32 MediaId,
+	IN EFI_LBA LBA,
+	IN OUT EFI_BLOCK_IO2_TOKEN *Token,
+	IN UINTN BufferSize,
+	OUT VOID *Buffer
+	);
+
+typedef EFI_STATUS (EFIAPI *EFI_BLOCK_WRITE_EX) (
+	IN struct _EFI_BLOCK_IO2_PROTOCOL *This,
+	IN UINT32 MediaId,
+	IN EFI_LBA LBA,
+	IN OUT EFI_BLOCK_IO2_TOKEN *Token,
+	IN UINTN BufferSize,
+	IN VOID *Buffer
+	);
+
+typedef EFI_STATUS (EFIAPI *EFI_BLOCK_FLUSH_EX) (
+	IN struct _EFI_BLOCK_IO2_PROTOCOL *This,
+	IN OUT EFI_BLOCK_IO2_TOKEN *Token
+	);
+
+typedef struct _EFI_BLOCK_IO2_PROTOCOL {
+	EFI_BLOCK_IO_MEDIA *Media;
+	EFI_BLOCK_RESET_EX Reset;
+	EFI_BLOCK_READ_EX ReadBlocksEx;
+	EFI_BLOCK_WRITE_EX WriteBlocksEx;
+	EFI_BLOCK_FLUSH_EX FlushBlocksEx;
+} EFI_BLOCK_IO2_PROTOCOL;
+#endif
+
+/* Return EFI_UNSUPPORTED if the storage is not an eMMC reachable
+ * through the SD host I/O protocol */
+EFI_STATUS storage_get_geometry(const struct storage_geometry **geometry);
+
+/* Erase Block protocol of the device of BIO, EFI_UNSUPPORTED if the
+ * firmware does not provide one */
+EFI_STATUS storage_get_erase_protocol(EFI_BLOCK_IO *bio, EFI_ERASE_BLOCK_PROTOCOL **erase);
+
+/* Storage statistics, for "oem storage-stats" */
+struct io_stats {
+	UINT32 count;
+	UINT64 bytes;
+	UINT64 us;
+};
+
+/* Asynchronous I/O on the disk of BIO at byte OFFSET.  The request
+ * may complete before aio_write() or aio_read() returns, otherwise
+ * DATA must be left untouched until aio_wait() returns.  Unaligned
+ * requests need DIO.  STATS, if not NULL, accounts for the request
+ * once it is complete.  aio_wait() returns the status of the pending
+ * request, EFI_SUCCESS if there is none. */
+#define AIO_QUEUE_DEPTH 4
+
+struct aio_request {
+	EFI_BLOCK_IO2_TOKEN token;
+	BOOLEAN busy;
+	UINT64 start_us;
+	UINTN size;
+	struct io_stats *stats;
+};
+
+BOOLEAN aio_available(EFI_BLOCK_IO *bio);
+EFI_STATUS aio_write(struct aio_request *req, EFI_BLOCK_IO *bio, EFI_DISK_IO *dio,
+		     UINT64 offset, UINTN size, VOID *data, struct io_stats *stats);
+EFI_STATUS aio_read(struct aio_request *req, EFI_BLOCK_IO *bio, EFI_DISK_IO *dio,
+		    UINT64 offset, UINTN size, VOID *data, struct io_stats *stats);
+EFI_STATUS aio_wait(struct aio_request *req);
+
+/* Synchronous I/O, through Block I/O when the request is aligned,
+ * through DIO otherwise */
+EFI_STATUS storage_write(EFI_BLOCK_IO *bio, EFI_DISK_IO *dio, UINT64 offset,
+			 UINTN size, VOID *data, struct io_stats *stats);
+EFI_STATUS storage_read(EFI_BLOCK_IO *bio, EFI_DISK_IO *dio, UINT64 offset,
+			UINTN size, VOID *data, struct io_stats *stats);
+
+/* Page based buffer aligned on the IoAlign and the block size of
+ * BIO, which may be NULL, to be freed with storage_free() */
+VOID *storage_alloc(EFI_BLOCK_IO *bio, UINTN size);
+void storage_free(VOID *buffer, UINTN size);
+
+#endif	/* _STORAGE_H_ */
@@ -333,6 +333,47 @@ EFI_STATUS uefi_msleep(UINTN mseconds)
 	return uefi_usleep(mseconds * 1000);
 }
 
+/* Time stamps based on the CPU time-stamp counter, calibrated
+ * against the firmware Stall() service on first use. */
+static UINT64 rdtsc(void)
+{
+	UINT32 lo, hi;
+
+	asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((UINT64)hi << 32) | lo;
+}
+
+#define TSC_CALIBRATION_MS 10
+
+static UINT64 tsc_per_ms(void)
+{
+	static UINT64 freq;
+	UINT64 start;
+
+	if (!freq) {
+		start = rdtsc();
+		uefi_msleep(TSC_CALIBRATION_MS);
+		freq = (rdtsc() - start) / TSC_CALIBRATION_MS;
+		if (!freq)
+			freq = 1;
+	}
+
+	return freq;
+}
+
+UINT64 uefi_get_ms(void)
+{
+	return rdtsc() / tsc_per_ms();
+}
+
+UINT64 uefi_get_us(void)
+{
+	UINT64 freq = tsc_per_ms();
+	UINT64 tsc = rdtsc();
+
+	return (tsc / freq) * 1000 + (tsc % freq) * 1000 / freq;
+}
+
 int sprintf(char *str, const char *format, ...)
 {
 	va_list args;
@@ -352,7 +393,7 @@ int sprintf(char *str, const char *format, ...)
 		goto free_format16;
 
 	len = StrLen(str16);
-	if (str_to_stra((CHAR8 *)str, str16, len) == EFI_SUCCESS) {
+	if (str_to_stra((CHAR8 *)str, str16, len + 1) == EFI_SUCCESS) {
 		ret = 0;
 		str[len] = '\0';
 	}
@@ -45,6 +45,8 @@ typedef UINTN size_t;
 #define DIV_ROUND_UP(x, y) (((x) + (y) - 1)/(y))
 #define ALIGN(x, y) ((y) * DIV_ROUND_UP((x), (y)))
 #define ALIGN_DOWN(x, y) ((y) * ((x) / (y)))
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
 
 EFI_STATUS get_esp_handle(EFI_HANDLE *esp);
 EFI_STATUS get_esp_fs(EFI_FILE_IO_INTERFACE **esp_fs);
@@ -58,6 +60,8 @@ EFI_STATUS uefi_create_directory(EFI_FILE *parent, CHAR16 *dirname);
 EFI_STATUS uefi_create_directory_root(EFI_FILE_IO_INTERFACE *io, CHAR16 *dirname);
 EFI_STATUS uefi_usleep(UINTN useconds);
 EFI_STATUS uefi_msleep(UINTN mseconds);
+UINT64 uefi_get_ms(void);
+UINT64 uefi_get_us(void);
 
 int sprintf(char *str, const char *format, ...);
 
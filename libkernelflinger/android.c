@@ -41,6 +41,7 @@
 #include "vars.h"
 #include "power.h"
 #include "../libfastboot/gpt.h"
+#include "../libfastboot/storage.h"
 
 
 struct setup_header {
@@ -764,8 +765,10 @@ EFI_STATUS android_image_load_partition(
                 return EFI_INVALID_PARAMETER;
         }
 
+        /* An aligned buffer, so that Disk I/O reads the blocks in
+         * place rather than through its bounce buffer */
         img_size = bootimage_size(&aosp_header) + BOOT_SIGNATURE_MAX_SIZE;
-        bootimage = AllocatePool(img_size);
+        bootimage = storage_alloc(use_label ? gparti.bio : BlockIo, img_size);
         if (!bootimage)
                 return EFI_OUT_OF_RESOURCES;
 
@@ -781,7 +784,7 @@ EFI_STATUS android_image_load_partition(
 
         if (EFI_ERROR(ret)) {
                 efi_perror(ret, "ReadDisk");
-                FreePool(bootimage);
+                storage_free(bootimage, img_size);
                 return ret;
         }
 
@@ -791,6 +794,17 @@ EFI_STATUS android_image_load_partition(
 }
 
 
+VOID android_image_free_partition(IN VOID *bootimage)
+{
+        struct boot_img_hdr *aosp_header = bootimage;
+
+        if (!bootimage)
+                return;
+
+        storage_free(bootimage, bootimage_size(aosp_header) + BOOT_SIGNATURE_MAX_SIZE);
+}
+
+
 EFI_STATUS android_image_load_file(
                 IN EFI_HANDLE device,
                 IN CHAR16 *loader,